@@ -23,7 +23,10 @@
 #include <istream>
 #include <vector>
 
+#include "evaluate.h"
+#include "material.h"
 #include "misc.h"
+#include "movegen.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -86,6 +89,91 @@ const vector<string> Defaults = {
   "7k/7P/6K1/8/3B4/8/8/8 b - -"
 };
 
+
+// evaluate() evaluates 'count' times the positions one legal move away from
+// the given one, making and unmaking the moves like the search does, and
+// returns the number of evaluations.
+
+uint64_t evaluate(Position& pos, int count) {
+
+  uint64_t cnt = 0;
+  StateInfo st;
+
+  if (!pos.checkers())
+      Eval::evaluate(pos);
+
+  for (int i = 0; i < count; ++i)
+      for (const auto& m : MoveList<LEGAL>(pos))
+      {
+          pos.do_move(m, st);
+
+          if (!pos.checkers())
+          {
+              Eval::evaluate(pos);
+              ++cnt;
+          }
+
+          pos.undo_move(m);
+      }
+
+  return cnt;
+}
+
+
+// check_terms() plays 'count' random games of up to 64 plies from the given
+// position and compares, after each move made or unmade, the incrementally
+// updated evaluation terms with a full computation. It returns the number of
+// positions checked and reports the mismatches, counted in 'mismatches'.
+
+uint64_t check_terms(Position& pos, int count, PRNG& rng, uint64_t& mismatches) {
+
+  const int MaxPlies = 64;
+
+  uint64_t cnt = 0;
+  StateInfo st[MaxPlies];
+  Move moves[MaxPlies];
+
+  auto check = [&]() {
+      Score incremental = pos.eval_terms(), full = Eval::compute_terms(pos);
+      ++cnt;
+
+      if (incremental != full)
+      {
+          ++mismatches;
+          cerr << "Mismatch: " << pos.fen()
+               << " incremental " << mg_value(incremental) << " " << eg_value(incremental)
+               << " full " << mg_value(full) << " " << eg_value(full) << endl;
+      }
+  };
+
+  check();
+
+  for (int i = 0; i < count; ++i)
+  {
+      int ply = 0;
+
+      for ( ; ply < MaxPlies; ++ply)
+      {
+          MoveList<LEGAL> legal(pos);
+
+          if (!legal.size())
+              break;
+
+          moves[ply] = *(legal.begin() + rng.rand<unsigned>() % legal.size());
+          pos.do_move(moves[ply], st[ply]);
+          check();
+      }
+
+      while (ply--)
+      {
+          pos.undo_move(moves[ply]);
+          check();
+      }
+  }
+
+  return cnt;
+}
+
 } // namespace
 
 /// benchmark() runs a simple benchmark by letting Stockfish analyze a set
@@ -94,7 +182,13 @@ const vector<string> Defaults = {
 /// be used, the limit value spent for each position (optional, default is
 /// depth 13), an optional file name where to look for positions in FEN
 /// format (defaults are the positions defined above) and the type of the
-/// limit value: depth (default), time in millisecs or number of nodes.
+/// limit value: depth (default), time in millisecs or number of nodes. With
+/// 'eval' the positions are not searched, instead the limit is the number of
+/// times their children are evaluated, to measure the evaluation alone. With
+/// 'evalcheck', available in debug builds only, the limit is the number of
+/// random games played from each position to verify the incrementally updated
+/// evaluation terms. With 'material' nothing is searched, the command measures
+/// the time to compute a material entry from scratch instead.
 
 void benchmark(const Position& current, istream& is) {
 
@@ -112,6 +206,21 @@ void benchmark(const Position& current, istream& is) {
   Options["Hash"]    = ttSize;
   Options["Threads"] = threads;
   Search::clear();
+  Bitbases::wait(); // The results must not depend on when the tables are ready
+
+#ifdef NDEBUG
+  if (limitType == "evalcheck")
+  {
+      cerr << "evalcheck needs a debug build" << endl;
+      return;
+  }
+#endif
+
+  if (limitType == "material")
+  {
+      cerr << "Material miss   : " << int(Material::miss_cost()) << " ns" << endl;
+      return;
+  }
 
   if (limitType == "time")
       limits.movetime = stoi(limit); // movetime is in millisecs
@@ -149,13 +258,17 @@ void benchmark(const Position& current, istream& is) {
       file.close();
   }
 
-  uint64_t nodes = 0;
+  uint64_t nodes = 0, evalProbes = 0, evalHits = 0, mismatches = 0;
+  uint64_t pawnProbes = 0, pawnHits = 0, kingSafetyCalls = 0, kingSafetyUpdates = 0;
+  uint64_t tbHits = 0, tbCacheHits = 0;
+  Eval::Profile profile = Eval::Profile();
   TimePoint elapsed = now();
   Position pos;
+  PRNG rng(1070372);
 
   for (size_t i = 0; i < fens.size(); ++i)
   {
-      StateListPtr states(new std::deque<StateInfo>(1));
+      StateListPtr states(new std::vector<StateInfo>(1));
       pos.set(fens[i], Options["UCI_Chess960"], &states->back(), Threads.main());
 
       cerr << "\nPosition: " << i + 1 << '/' << fens.size() << endl;
@@ -163,12 +276,32 @@ void benchmark(const Position& current, istream& is) {
       if (limitType == "perft")
           nodes += Search::perft(pos, limits.depth * ONE_PLY);
 
+      else if (limitType == "evalcheck")
+          nodes += check_terms(pos, limits.depth, rng, mismatches);
+
+      else if (limitType == "eval")
+      {
+          Threads.main()->evalProfile = Eval::Profile();
+          nodes += evaluate(pos, limits.depth);
+          profile += Threads.main()->evalProfile;
+      }
+
       else
       {
           limits.startTime = now();
           Threads.start_thinking(pos, states, limits);
           Threads.main()->wait_for_search_finished();
           nodes += Threads.nodes_searched();
+          tbHits += Threads.tb_hits(), tbCacheHits += Threads.tb_cache_hits();
+
+          for (Thread* th : Threads)
+          {
+              evalProbes += th->evalProbes, evalHits += th->evalHits;
+              pawnProbes += th->pawnsTable.probes, pawnHits += th->pawnsTable.hits;
+              kingSafetyCalls += th->pawnsTable.kingSafetyCalls;
+              kingSafetyUpdates += th->pawnsTable.kingSafetyUpdates;
+              profile += th->evalProfile;
+          }
       }
   }
 
@@ -177,7 +310,29 @@ void benchmark(const Position& current, istream& is) {
   dbg_print(); // Just before exiting
 
   cerr << "\n==========================="
-       << "\nTotal time (ms) : " << elapsed
-       << "\nNodes searched  : " << nodes
-       << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+       << "\nEvaluation      : " << (NNUE::Enabled ? "NNUE" : "classical")
+       << "\nTotal time (ms) : " << elapsed;
+
+  if (limitType == "eval")
+      cerr << "\nEvaluations     : " << nodes
+           << "\nEvals/second    : " << 1000 * nodes / elapsed << endl;
+  else if (limitType == "evalcheck")
+      cerr << "\nTerms checked   : " << nodes
+           << "\nMismatches      : " << mismatches << endl;
+  else
+      cerr << "\nNodes searched  : " << nodes
+           << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+
+  if (limitType != "perft" && limitType != "eval" && limitType != "evalcheck")
+      cerr << "Pawn hash hits  : " << pawnHits << "/" << pawnProbes
+           << "\nKing safety     : " << kingSafetyUpdates << "/" << kingSafetyCalls << " computed" << endl;
+
+  if (tbHits)
+      cerr << "TB hits         : " << tbHits << " (" << tbCacheHits << " from cache)" << endl;
+
+  if (HasEvalCache)
+      cerr << "Eval cache hits : " << evalHits << "/" << evalProbes << endl;
+
+  if (HasEvalProfile)
+      cerr << "\n" << Eval::profile(profile) << endl;
 }
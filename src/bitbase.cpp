@@ -19,13 +19,17 @@
 */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <numeric>
+#include <thread>
 #include <vector>
 
 #include "bitboard.h"
 #include "types.h"
 
+using namespace Bitbases;
+
 namespace {
 
   // There are 24 possible pawn squares: the first 4 files and ranks from 2 to 7
@@ -70,6 +74,86 @@ namespace {
     Result result;
   };
 
+  // A mate table stores, for an endgame where white mates the lone black king,
+  // the distance to mate in plies of each position with the best play of both
+  // sides, or NoMate when it is a draw: a stalemate or a white piece that can be
+  // captured, because the tables are only built for endgames where this is a
+  // draw. The white king is always in the a1-d1-d4 triangle, so an index is
+  //
+  // bit      0-5: square of the last white piece
+  // bit     6-11: square of the previous white piece, and so on
+  // next 6 bits : black king square
+  // the rest    : side to move * 10 + white king index in the triangle
+  //
+  // The tables of the 3 pieces endgames take 80 KB each and the one of KBNK
+  // 5 MB, one byte per position.
+  const uint8_t NoMate = 0xFF;
+
+  int Triangle[SQUARE_NB]; // Index in the a1-d1-d4 triangle, or -1 outside
+  Square TriangleSq[10];
+
+  struct MatePosition {
+    Color us;
+    Square ksq[COLOR_NB], psq[2];
+  };
+
+  class MateTable {
+
+    unsigned size() const { return 20U << (6 * (pieceCnt + 1)); }
+    unsigned index(const MatePosition& p) const;
+    bool decode(unsigned idx, MatePosition& p) const;
+    Bitboard attacks(const MatePosition& p, Bitboard occupied) const;
+    void mark(MatePosition p, uint8_t ply, std::vector<unsigned>& won);
+
+    PieceType pieces[2];
+    int pieceCnt;
+    std::vector<uint8_t> dtm;
+
+  public:
+    void init(PieceType pt1, PieceType pt2 = NO_PIECE_TYPE);
+    uint8_t operator[](const MatePosition& p) const { return dtm[index(p)]; }
+  };
+
+  MateTable MateTables[Bitbases::MATE_TABLE_NB];
+
+  // The KBNK table is built by a background thread, see Bitbases::init(). The
+  // thread is joined when destroyed, so that exit() can be called at any time.
+  struct Builder : std::thread {
+    using std::thread::operator=;
+   ~Builder() { if (joinable()) join(); }
+  } KBNKBuilder;
+  std::atomic<bool> KBNKReady;
+
+  // Mirror the square by the symmetry 't': bit 0 mirrors the files, bit 1 the
+  // ranks and bit 2 the a1-h8 diagonal, in this order.
+  Square mirror(Square s, int t) {
+
+    if (t & 1) s = Square(s ^ 7);
+    if (t & 2) s = Square(s ^ 56);
+    if (t & 4) s = Square(((s >> 3) | (s << 3)) & 63);
+    return s;
+  }
+
+  // Map a position so that the white king is in the a1-d1-d4 triangle
+  MatePosition normalize(MatePosition p, bool flipDiagonal = false) {
+
+    Square k = p.ksq[WHITE];
+    int t = (file_of(k) > FILE_D) | (rank_of(k) > RANK_4) << 1;
+    k = mirror(k, t);
+    t |= (int(rank_of(k)) > int(file_of(k)) || flipDiagonal) << 2;
+
+    if (!t)
+        return p;
+
+    p.ksq[WHITE] = mirror(p.ksq[WHITE], t);
+    p.ksq[BLACK] = mirror(p.ksq[BLACK], t);
+    for (Square& s : p.psq)
+        if (s != SQ_NONE)
+            s = mirror(s, t);
+
+    return p;
+  }
+
 } // namespace
 
 
@@ -101,6 +185,58 @@ void Bitbases::init() {
   for (idx = 0; idx < MAX_INDEX; ++idx)
       if (db[idx] == WIN)
           KPKBitbase[idx / 32] |= 1 << (idx & 0x1F);
+
+  for (Square s = SQ_A1; s <= SQ_H8; ++s)
+      Triangle[s] = -1;
+
+  int t = 0;
+  for (Rank r = RANK_1; r <= RANK_4; ++r)
+      for (File f = File(r); f <= FILE_D; ++f)
+          TriangleSq[Triangle[make_square(f, r)] = t++] = make_square(f, r);
+
+  MateTables[KQK_TABLE].init(QUEEN);
+  MateTables[KRK_TABLE].init(ROOK);
+
+  // Building the KBNK table takes about a second, so it is done in the
+  // background to not delay the startup. Until it is ready the endgame is
+  // evaluated with a heuristic, see Endgame<KBNK>.
+  KBNKReady = false;
+  KBNKBuilder = std::thread([]() {
+      MateTables[KBNK_TABLE].init(BISHOP, KNIGHT);
+      KBNKReady.store(true, std::memory_order_release);
+  });
+}
+
+
+/// Bitbases::wait() waits for the tables built in the background. It is called
+/// on 'isready', before a benchmark, so that it is reproducible, and at exit.
+
+void Bitbases::wait() {
+
+  if (KBNKBuilder.joinable())
+      KBNKBuilder.join();
+}
+
+
+/// Bitbases::is_ready() returns whether the given mate table can be probed
+
+bool Bitbases::is_ready(MateTableCode t) {
+
+  return t != KBNK_TABLE || KBNKReady.load(std::memory_order_acquire);
+}
+
+
+/// Bitbases::probe() returns the distance to mate in plies of a position of the
+/// given mate table, with white as the strong side, or -1 if it is a draw.
+
+int Bitbases::probe(MateTableCode t, Color us, Square wksq, Square bksq, Square psq1, Square psq2) {
+
+  assert(is_ready(t));
+
+  MatePosition p = { us, { wksq, bksq }, { psq1, psq2 } };
+  uint8_t v = MateTables[t][normalize(p)];
+
+  return v == NoMate ? -1 : v;
 }
 
 
@@ -178,3 +314,197 @@ namespace {
   }
 
 } // namespace
+
+
+namespace {
+
+  unsigned MateTable::index(const MatePosition& p) const {
+
+    assert(Triangle[p.ksq[WHITE]] >= 0);
+
+    unsigned idx = ((p.us * 10 + Triangle[p.ksq[WHITE]]) << 6) | unsigned(p.ksq[BLACK]);
+
+    for (int i = 0; i < pieceCnt; ++i)
+        idx = (idx << 6) | unsigned(p.psq[i]);
+
+    return idx;
+  }
+
+  // Decode an index, returning false if the position is not valid: two pieces
+  // on the same square, adjacent kings or black in check with white to move.
+  bool MateTable::decode(unsigned idx, MatePosition& p) const {
+
+    p.psq[0] = p.psq[1] = SQ_NONE;
+
+    for (int i = pieceCnt - 1; i >= 0; --i, idx >>= 6)
+        p.psq[i] = Square(idx & 0x3F);
+
+    p.ksq[BLACK] = Square(idx & 0x3F);
+    p.us = Color(idx >> 6 >= 10);
+
+    p.ksq[WHITE] = TriangleSq[(idx >> 6) % 10];
+
+    Bitboard occupied = SquareBB[p.ksq[WHITE]] | p.ksq[BLACK];
+
+    for (int i = 0; i < pieceCnt; ++i)
+    {
+        if (occupied & p.psq[i])
+            return false;
+
+        occupied |= p.psq[i];
+    }
+
+    return    distance(p.ksq[WHITE], p.ksq[BLACK]) > 1
+           && (p.us == BLACK || !(attacks(p, occupied) & p.ksq[BLACK]));
+  }
+
+  // Squares attacked by white, with the given occupancy
+  Bitboard MateTable::attacks(const MatePosition& p, Bitboard occupied) const {
+
+    Bitboard b = PseudoAttacks[KING][p.ksq[WHITE]];
+
+    for (int i = 0; i < pieceCnt; ++i)
+        b |= attacks_bb(pieces[i], p.psq[i], occupied);
+
+    return b;
+  }
+
+  // Set the distance to mate of a white to move position, if it is legal and
+  // not yet known. A position with the white king on the a1-d4 diagonal and its
+  // mirror image are both stored, so both are set.
+  void MateTable::mark(MatePosition p, uint8_t ply, std::vector<unsigned>& won) {
+
+    p = normalize(p);
+
+    if (dtm[index(p)] != NoMate)
+        return;
+
+    Bitboard occupied = SquareBB[p.ksq[WHITE]] | p.ksq[BLACK];
+    for (int i = 0; i < pieceCnt; ++i)
+        occupied |= p.psq[i];
+
+    if (attacks(p, occupied) & p.ksq[BLACK])
+        return;
+
+    for (int flip = 0; flip < 2; ++flip)
+    {
+        unsigned idx = index(flip ? normalize(p, true) : p);
+
+        if (dtm[idx] == NoMate)
+        {
+            dtm[idx] = ply;
+            won.push_back(idx);
+        }
+
+        if (int(rank_of(p.ksq[WHITE])) != int(file_of(p.ksq[WHITE])))
+            break;
+    }
+  }
+
+  // Build the table by retrograde analysis: from the mates, unmake white moves
+  // to find the positions that are won in one more ply, then unmake black moves
+  // from them, and count down the legal moves of the black to move positions
+  // reached: when none is left, each of them leads to a won position, so the
+  // position is lost.
+  void MateTable::init(PieceType pt1, PieceType pt2) {
+
+    const uint8_t Escape = 0xFF; // Black can capture a piece: a draw
+
+    pieces[0] = pt1, pieces[1] = pt2;
+    pieceCnt = pt2 == NO_PIECE_TYPE ? 1 : 2;
+    dtm.assign(size(), NoMate);
+
+    std::vector<uint8_t> moves(size()); // Legal moves of black left to refute
+    std::vector<unsigned> lost, won;
+    MatePosition p;
+
+    // Find the mates and count the legal moves of the other black positions
+    for (unsigned idx = size() / 2; idx < size(); ++idx)
+    {
+        if (!decode(idx, p))
+            continue;
+
+        Bitboard white = SquareBB[p.ksq[WHITE]];
+        for (int i = 0; i < pieceCnt; ++i)
+            white |= p.psq[i];
+
+        // Sliders attack through the black king
+        Bitboard attacked = attacks(p, white);
+        Bitboard b = PseudoAttacks[KING][p.ksq[BLACK]] & ~attacked;
+
+        if (b & white)
+            moves[idx] = Escape;
+
+        else if (!b && (attacked & p.ksq[BLACK]))
+        {
+            dtm[idx] = 0;
+            lost.push_back(idx);
+        }
+        else
+            moves[idx] = uint8_t(popcount(b)); // Zero for a stalemate, that is a draw
+    }
+
+    for (uint8_t ply = 0; !lost.empty(); ply += 2)
+    {
+        won.clear();
+        std::sort(lost.begin(), lost.end());
+
+        // White to move positions from which a move leads to a lost position
+        for (unsigned idx : lost)
+        {
+            decode(idx, p);
+
+            Bitboard occupied = SquareBB[p.ksq[WHITE]] | p.ksq[BLACK];
+            for (int i = 0; i < pieceCnt; ++i)
+                occupied |= p.psq[i];
+
+            p.us = WHITE;
+
+            for (int i = -1; i < pieceCnt; ++i)
+            {
+                Square& s = i < 0 ? p.ksq[WHITE] : p.psq[i];
+                Square from = s;
+                Bitboard b = (i < 0 ? PseudoAttacks[KING][s] : attacks_bb(pieces[i], s, occupied)) & ~occupied;
+
+                while (b)
+                {
+                    s = pop_lsb(&b);
+
+                    if (distance(p.ksq[WHITE], p.ksq[BLACK]) > 1)
+                        mark(p, uint8_t(ply + 1), won);
+                }
+
+                s = from;
+            }
+        }
+
+        lost.clear();
+
+        // Black to move positions from which all the moves lead to won positions
+        for (unsigned idx : won)
+        {
+            decode(idx, p);
+
+            Bitboard occupied = SquareBB[p.ksq[WHITE]];
+            for (int i = 0; i < pieceCnt; ++i)
+                occupied |= p.psq[i];
+
+            Bitboard b = PseudoAttacks[KING][p.ksq[BLACK]] & ~occupied & ~PseudoAttacks[KING][p.ksq[WHITE]];
+            p.us = BLACK;
+
+            while (b)
+            {
+                p.ksq[BLACK] = pop_lsb(&b);
+                unsigned i = index(p);
+
+                if (dtm[i] == NoMate && moves[i] != Escape && !--moves[i])
+                {
+                    dtm[i] = uint8_t(ply + 2);
+                    lost.push_back(i);
+                }
+            }
+        }
+    }
+  }
+
+} // namespace
@@ -27,8 +27,13 @@
 
 namespace Bitbases {
 
+enum MateTableCode { KQK_TABLE, KRK_TABLE, KBNK_TABLE, MATE_TABLE_NB };
+
 void init();
+void wait();
+bool is_ready(MateTableCode t);
 bool probe(Square wksq, Square wpsq, Square bksq, Color us);
+int probe(MateTableCode t, Color us, Square wksq, Square bksq, Square psq1, Square psq2 = SQ_NONE);
 
 }
 
@@ -263,6 +268,17 @@ inline Bitboard attacks_bb(PieceType pt, Square s, Bitboard occupied) {
 
 inline int popcount(Bitboard b) {
 
+#if defined(USE_DISPATCH)
+
+  if (HasPopCnt)
+  {
+      Bitboard r;
+      __asm__("popcnt %1, %0" : "=r" (r) : "r" (b));
+      return int(r);
+  }
+
+#endif
+
 #ifndef USE_POPCNT
 
   extern uint8_t PopCnt16[1 << 16];
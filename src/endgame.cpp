@@ -20,6 +20,9 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
 
 #include "bitboard.h"
 #include "endgame.h"
@@ -83,6 +86,31 @@ namespace {
     return sq;
   }
 
+  // Evaluate a position of an endgame with a mate table: the shorter the mate,
+  // the higher the score. The pieces are given in the order of the table.
+  Value mate_table_value(const Position& pos, Color strongSide, Bitbases::MateTableCode t,
+                         Square psq1, Square psq2 = SQ_NONE) {
+
+    Color us = strongSide == pos.side_to_move() ? WHITE : BLACK;
+    Square wksq = relative_square(strongSide, pos.square<KING>(strongSide));
+    Square bksq = relative_square(strongSide, pos.square<KING>(~strongSide));
+
+    psq1 = relative_square(strongSide, psq1);
+    if (psq2 != SQ_NONE)
+        psq2 = relative_square(strongSide, psq2);
+
+    int dtm = Bitbases::probe(t, us, wksq, bksq, psq1, psq2);
+
+    if (dtm < 0)
+        return VALUE_DRAW;
+
+    Value result =  VALUE_KNOWN_WIN
+                  + pos.non_pawn_material(strongSide)
+                  + Value(2 * (MAX_PLY - dtm));
+
+    return strongSide == pos.side_to_move() ? result : -result;
+  }
+
 } // namespace
 
 
@@ -107,6 +135,33 @@ Endgames::Endgames() {
   add<KBPKN>("KBPKN");
   add<KBPPKB>("KBPPKB");
   add<KRPPKRP>("KRPPKRP");
+
+  build();
+}
+
+
+/// Endgames::build() finds the shift of the perfect hash and fills the slots
+
+void Endgames::build() {
+
+  for (shift = 0; shift <= 64 - 7; ++shift)
+  {
+      std::fill(std::begin(slots), std::end(slots), Entry{ 0, EVALUATION_FUNCTIONS, WHITE });
+
+      bool collision = false;
+      for (const Entry& e : endgames)
+      {
+          Entry& slot = slots[(e.key >> shift) & (TableSize - 1)];
+          collision |= slot.code != EVALUATION_FUNCTIONS;
+          slot = e;
+      }
+
+      if (!collision)
+          return;
+  }
+
+  std::cerr << "No perfect hash for the endgames, increase TableSize" << std::endl;
+  exit(EXIT_FAILURE);
 }
 
 
@@ -124,6 +179,13 @@ Value Endgame<KXK>::operator()(const Position& pos) const {
   if (pos.side_to_move() == weakSide && !MoveList<LEGAL>(pos).size())
       return VALUE_DRAW;
 
+  // KQK and KRK are evaluated with the help of a mate table
+  if (pos.count<ALL_PIECES>() == 3 && pos.count<QUEEN>(strongSide))
+      return mate_table_value(pos, strongSide, Bitbases::KQK_TABLE, pos.square<QUEEN>(strongSide));
+
+  if (pos.count<ALL_PIECES>() == 3 && pos.count<ROOK>(strongSide))
+      return mate_table_value(pos, strongSide, Bitbases::KRK_TABLE, pos.square<ROOK>(strongSide));
+
   Square winnerKSq = pos.square<KING>(strongSide);
   Square loserKSq = pos.square<KING>(weakSide);
 
@@ -143,21 +205,27 @@ Value Endgame<KXK>::operator()(const Position& pos) const {
 }
 
 
-/// Mate with KBN vs K. This is similar to KX vs K, but we have to drive the
-/// defending king towards a corner square of the right color.
+/// Mate with KBN vs K. This endgame is evaluated with the help of a mate table,
+/// which also knows the draws where the defending king wins a piece. While the
+/// table is being built, we drive the defending king towards a corner square of
+/// the right color, as in KX vs K.
 template<>
 Value Endgame<KBNK>::operator()(const Position& pos) const {
 
   assert(verify_material(pos, strongSide, KnightValueMg + BishopValueMg, 0));
   assert(verify_material(pos, weakSide, VALUE_ZERO, 0));
 
+  if (Bitbases::is_ready(Bitbases::KBNK_TABLE))
+      return mate_table_value(pos, strongSide, Bitbases::KBNK_TABLE,
+                              pos.square<BISHOP>(strongSide), pos.square<KNIGHT>(strongSide));
+
   Square winnerKSq = pos.square<KING>(strongSide);
   Square loserKSq = pos.square<KING>(weakSide);
   Square bishopSq = pos.square<BISHOP>(strongSide);
 
-  // kbnk_mate_table() tries to drive toward corners A1 or H8. If we have a
-  // bishop that cannot reach the above squares, we flip the kings in order
-  // to drive the enemy toward corners A8 or H1.
+  // PushToCorners[] drives toward corners A1 or H8. If we have a bishop that
+  // cannot reach the above squares, we flip the kings in order to drive the
+  // enemy toward corners A8 or H1.
   if (opposite_colors(bishopSq, SQ_A1))
   {
       winnerKSq = ~winnerKSq;
@@ -814,3 +882,49 @@ ScaleFactor Endgame<KPKP>::operator()(const Position& pos) const {
   // it's probably at least a draw even with the pawn.
   return Bitbases::probe(wksq, psq, bksq, us) ? SCALE_FACTOR_NONE : SCALE_FACTOR_DRAW;
 }
+
+
+/// Endgames::evaluate() and Endgames::scale_factor() call the endgame function
+/// of the given code. They are defined after all the specializations, so that
+/// the functions can be inlined in the switch.
+
+Value Endgames::evaluate(EndgameCode code, Color strongSide, const Position& pos) {
+
+  switch (code)
+  {
+  case KNNK: return Endgame<KNNK>(strongSide)(pos);
+  case KXK:  return Endgame<KXK >(strongSide)(pos);
+  case KBNK: return Endgame<KBNK>(strongSide)(pos);
+  case KPK:  return Endgame<KPK >(strongSide)(pos);
+  case KRKP: return Endgame<KRKP>(strongSide)(pos);
+  case KRKB: return Endgame<KRKB>(strongSide)(pos);
+  case KRKN: return Endgame<KRKN>(strongSide)(pos);
+  case KQKP: return Endgame<KQKP>(strongSide)(pos);
+  case KQKR: return Endgame<KQKR>(strongSide)(pos);
+  default:
+      assert(false);
+      return VALUE_NONE;
+  }
+}
+
+ScaleFactor Endgames::scale_factor(EndgameCode code, Color strongSide, const Position& pos) {
+
+  switch (code)
+  {
+  case KBPsK:   return Endgame<KBPsK  >(strongSide)(pos);
+  case KQKRPs:  return Endgame<KQKRPs >(strongSide)(pos);
+  case KRPKR:   return Endgame<KRPKR  >(strongSide)(pos);
+  case KRPKB:   return Endgame<KRPKB  >(strongSide)(pos);
+  case KRPPKRP: return Endgame<KRPPKRP>(strongSide)(pos);
+  case KPsK:    return Endgame<KPsK   >(strongSide)(pos);
+  case KBPKB:   return Endgame<KBPKB  >(strongSide)(pos);
+  case KBPPKB:  return Endgame<KBPPKB >(strongSide)(pos);
+  case KBPKN:   return Endgame<KBPKN  >(strongSide)(pos);
+  case KNPK:    return Endgame<KNPK   >(strongSide)(pos);
+  case KNPKB:   return Endgame<KNPKB  >(strongSide)(pos);
+  case KPKP:    return Endgame<KPKP   >(strongSide)(pos);
+  default:
+      assert(false);
+      return SCALE_FACTOR_NONE;
+  }
+}
@@ -21,11 +21,9 @@
 #ifndef ENDGAME_H_INCLUDED
 #define ENDGAME_H_INCLUDED
 
-#include <map>
-#include <memory>
 #include <string>
 #include <type_traits>
-#include <utility>
+#include <vector>
 
 #include "position.h"
 #include "types.h"
@@ -68,58 +66,62 @@ template<EndgameCode E> using
 eg_type = typename std::conditional<(E < SCALING_FUNCTIONS), Value, ScaleFactor>::type;
 
 
-/// Base and derived functors for endgame evaluation and scaling functions
+/// Functors for endgame evaluation and scaling functions. They are not called
+/// through a virtual interface: the material entries only store the endgame
+/// code, and Endgames::evaluate() and Endgames::scale_factor() dispatch on it
+/// with a switch, so that the compiler can inline the actual functions.
 
-template<typename T>
-struct EndgameBase {
+template<EndgameCode E, typename T = eg_type<E>>
+struct Endgame {
 
-  explicit EndgameBase(Color c) : strongSide(c), weakSide(~c) {}
-  virtual ~EndgameBase() = default;
-  virtual T operator()(const Position&) const = 0;
+  explicit Endgame(Color c) : strongSide(c), weakSide(~c) {}
+  T operator()(const Position&) const;
 
   const Color strongSide, weakSide;
 };
 
 
-template<EndgameCode E, typename T = eg_type<E>>
-struct Endgame : public EndgameBase<T> {
+/// The Endgames class stores the codes of the endgames with a specialized
+/// evaluation or scaling function, together with their strong side, in a flat
+/// table indexed by a perfect hash of the material key: once all the endgames
+/// are added, build() looks for a shift such that the selected key bits are
+/// different for all of them, so that a probe is a single lookup and key compare.
 
-  explicit Endgame(Color c) : EndgameBase<T>(c) {}
-  T operator()(const Position&) const;
-};
+class Endgames {
 
+  static const int TableSize = 128;
 
-/// The Endgames class stores the pointers to endgame evaluation and scaling
-/// base objects in two std::map. We use polymorphism to invoke the actual
-/// endgame function by calling its virtual operator().
+public:
+  struct Entry {
+    Key key;
+    EndgameCode code;
+    Color strongSide;
+  };
 
-class Endgames {
+  Endgames();
 
-  template<typename T> using Ptr = std::unique_ptr<EndgameBase<T>>;
-  template<typename T> using Map = std::map<Key, Ptr<T>>;
+  static Value evaluate(EndgameCode code, Color strongSide, const Position& pos);
+  static ScaleFactor scale_factor(EndgameCode code, Color strongSide, const Position& pos);
 
-  template<typename T>
-  Map<T>& map() {
-    return std::get<std::is_same<T, ScaleFactor>::value>(maps);
+  const Entry* probe(Key key) const {
+    const Entry& e = slots[(key >> shift) & (TableSize - 1)];
+    return e.key == key && e.code != EVALUATION_FUNCTIONS ? &e : nullptr;
   }
 
-  template<EndgameCode E, typename T = eg_type<E>, typename P = Ptr<T>>
+private:
+  template<EndgameCode E>
   void add(const std::string& code) {
 
     StateInfo st;
-    map<T>()[Position().set(code, WHITE, &st).material_key()] = P(new Endgame<E>(WHITE));
-    map<T>()[Position().set(code, BLACK, &st).material_key()] = P(new Endgame<E>(BLACK));
+    endgames.push_back({ Position().set(code, WHITE, &st).material_key(), E, WHITE });
+    endgames.push_back({ Position().set(code, BLACK, &st).material_key(), E, BLACK });
   }
 
-  std::pair<Map<Value>, Map<ScaleFactor>> maps;
-
-public:
-  Endgames();
+  void build();
 
-  template<typename T>
-  EndgameBase<T>* probe(Key key) {
-    return map<T>().count(key) ? map<T>()[key].get() : nullptr;
-  }
+  std::vector<Entry> endgames;
+  Entry slots[TableSize];
+  int shift;
 };
 
 #endif // #ifndef ENDGAME_H_INCLUDED
@@ -23,11 +23,14 @@
 #include <cstring>   // For std::memset
 #include <iomanip>
 #include <sstream>
+#include <thread>
 
 #include "bitboard.h"
 #include "evaluate.h"
 #include "material.h"
+#include "nnue.h"
 #include "pawns.h"
+#include "thread.h"
 
 namespace {
 
@@ -94,8 +97,21 @@ namespace {
     ScaleFactor evaluate_scale_factor(Value eg);
     Score evaluate_initiative(Value eg);
 
+    // profile() charges the time since its previous call to the given stage
+    void profile(Eval::ProfileStage s) {
+      if (HasEvalProfile && !T)
+      {
+          uint64_t t = ticks();
+          Eval::Profile& p = pos.this_thread()->evalProfile;
+          p.calls[s]++;
+          p.ticks[s] += t - lastTicks;
+          lastTicks = t;
+      }
+    }
+
     // Data members
     const Position& pos;
+    uint64_t lastTicks = HasEvalProfile && !T ? ticks() : 0;
     Material::Entry* me;
     Pawns::Entry* pe;
     Bitboard mobilityArea[COLOR_NB];
@@ -299,9 +315,21 @@ namespace {
     while ((s = *pl++) != SQ_NONE)
     {
         // Find attacked squares, including x-ray attacks for bishops and rooks
-        b = Pt == BISHOP ? attacks_bb<BISHOP>(s, pos.pieces() ^ pos.pieces(Us, QUEEN))
-          : Pt ==   ROOK ? attacks_bb<  ROOK>(s, pos.pieces() ^ pos.pieces(Us, ROOK, QUEEN))
-                         : pos.attacks_from<Pt>(s);
+        if (HasAttackMaps)
+        {
+            // The incremental attacks are exact unless they hit an x-ray piece
+            b = pos.piece_attacks(s);
+
+            if (Pt == BISHOP && (b & pos.pieces(Us, QUEEN)))
+                b = attacks_bb<BISHOP>(s, pos.pieces() ^ pos.pieces(Us, QUEEN));
+
+            else if (Pt == ROOK && (b & pos.pieces(Us, ROOK, QUEEN)))
+                b = attacks_bb<  ROOK>(s, pos.pieces() ^ pos.pieces(Us, ROOK, QUEEN));
+        }
+        else
+            b = Pt == BISHOP ? attacks_bb<BISHOP>(s, pos.pieces() ^ pos.pieces(Us, QUEEN))
+              : Pt ==   ROOK ? attacks_bb<  ROOK>(s, pos.pieces() ^ pos.pieces(Us, ROOK, QUEEN))
+                             : pos.attacks_from<Pt>(s);
 
         if (pos.pinned_pieces(Us) & s)
             b &= LineBB[pos.square<KING>(Us)][s];
@@ -320,8 +348,10 @@ namespace {
 
         mobility[Us] += MobilityBonus[Pt - 2][mob];
 
-        // Bonus for this piece as a king protector
-        score += KingProtector[Pt - 2] * distance(s, pos.square<KING>(Us));
+        // Bonus for this piece as a king protector. Outside of tracing this
+        // is read from the incrementally updated terms, see value().
+        if (T)
+            score += KingProtector[Pt - 2] * distance(s, pos.square<KING>(Us));
 
         if (Pt == BISHOP || Pt == KNIGHT)
         {
@@ -815,6 +845,7 @@ namespace {
 
     // Probe the material hash table
     me = Material::probe(pos);
+    profile(Eval::PROFILE_MATERIAL);
 
     // If we have a specialized evaluation function for the current material
     // configuration, call it and return.
@@ -829,6 +860,7 @@ namespace {
     // Probe the pawn hash table
     pe = Pawns::probe(pos);
     score += pe->pawns_score();
+    profile(Eval::PROFILE_PAWNS);
 
     // Early exit if score is high
     Value v = (mg_value(score) + eg_value(score)) / 2;
@@ -839,26 +871,40 @@ namespace {
 
     initialize<WHITE>();
     initialize<BLACK>();
+    profile(Eval::PROFILE_INITIALIZE);
 
     score += evaluate_pieces<WHITE, KNIGHT>() - evaluate_pieces<BLACK, KNIGHT>();
+    profile(Eval::PROFILE_KNIGHTS);
     score += evaluate_pieces<WHITE, BISHOP>() - evaluate_pieces<BLACK, BISHOP>();
+    profile(Eval::PROFILE_BISHOPS);
     score += evaluate_pieces<WHITE, ROOK  >() - evaluate_pieces<BLACK, ROOK  >();
+    profile(Eval::PROFILE_ROOKS);
     score += evaluate_pieces<WHITE, QUEEN >() - evaluate_pieces<BLACK, QUEEN >();
 
+    assert(pos.eval_terms() == Eval::compute_terms(pos));
+
+    if (!T)
+        score += pos.eval_terms();
+
     score += mobility[WHITE] - mobility[BLACK];
+    profile(Eval::PROFILE_QUEENS);
 
     score +=  evaluate_king<WHITE>()
             - evaluate_king<BLACK>();
+    profile(Eval::PROFILE_KING);
 
     score +=  evaluate_threats<WHITE>()
             - evaluate_threats<BLACK>();
+    profile(Eval::PROFILE_THREATS);
 
     score +=  evaluate_passed_pawns<WHITE>()
             - evaluate_passed_pawns<BLACK>();
+    profile(Eval::PROFILE_PASSED);
 
     if (pos.non_pawn_material() >= SpaceThreshold)
         score +=  evaluate_space<WHITE>()
                 - evaluate_space<BLACK>();
+    profile(Eval::PROFILE_SPACE);
 
     score += evaluate_initiative(eg_value(score));
 
@@ -868,6 +914,7 @@ namespace {
        + eg_value(score) * int(PHASE_MIDGAME - me->game_phase()) * sf / SCALE_FACTOR_NORMAL;
 
     v /= int(PHASE_MIDGAME);
+    profile(Eval::PROFILE_SCALE);
 
     // In case of tracing add all remaining individual evaluation terms
     if (T)
@@ -888,14 +935,124 @@ namespace {
 } // namespace
 
 
-/// evaluate() is the evaluator for the outer world. It returns a static evaluation
-/// of the position from the point of view of the side to move.
+/// evaluate() is the evaluator for the outer world. It returns a static
+/// evaluation of the position from the point of view of the side to move,
+/// looking first in the thread's evaluation cache when this is enabled. The
+/// NNUE network replaces the classical evaluation when one has been loaded.
+
+Value Eval::evaluate(const Position& pos) {
+
+  if (!HasEvalCache)
+      return NNUE::Enabled ? NNUE::evaluate(pos) + Tempo : Evaluation<>(pos).value();
+
+  Thread* th = pos.this_thread();
+  Key key = pos.key();
+  Entry* e = th->evalTable[key];
+
+  ++th->evalProbes;
+
+  if (e->key == key)
+  {
+      ++th->evalHits;
+      return e->value;
+  }
+
+  e->key = key;
+  return e->value = NNUE::Enabled ? NNUE::evaluate(pos) + Tempo : Evaluation<>(pos).value();
+}
+
+/// evaluate_batch() writes to 'values' the static evaluation of each of the
+/// given positions, or VALUE_NONE when the side to move is in check. The work
+/// is split among as many workers as there are search threads, each one using
+/// the pawn and material tables of its thread, so no search must be running.
+
+void Eval::evaluate_batch(const std::vector<std::string>& fens, Value* values, bool chess960) {
+
+  std::vector<std::thread> workers;
+  size_t workerCnt = Threads.size();
+
+  for (size_t idx = 0; idx < workerCnt; ++idx)
+      workers.emplace_back([&, idx]() {
+
+          Position pos;
+          StateInfo st;
+
+          for (size_t i = idx; i < fens.size(); i += workerCnt)
+          {
+              pos.set(fens[i], chess960, &st, Threads[idx]);
+              values[i] = pos.checkers() ? VALUE_NONE : evaluate(pos);
+          }
+      });
+
+  for (std::thread& w : workers)
+      w.join();
+}
+
+
+/// profile() returns a string with the share of the evaluation time spent in
+/// each stage, from the counters filled by the profiler.
 
-Value Eval::evaluate(const Position& pos)
-{
-   return Evaluation<>(pos).value();
+std::string Eval::profile(const Profile& p) {
+
+  const char* Names[] = { "Material probe", "Pawns probe", "Initialize", "Knights",
+                          "Bishops", "Rooks", "Queens", "King safety", "Threats",
+                          "Passed pawns", "Space", "Scale factor" };
+  uint64_t total = 0;
+
+  for (int i = 0; i < PROFILE_STAGE_NB; ++i)
+      total += p.ticks[i];
+
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(1)
+     << "     Eval stage |       Calls |  Ticks/call |  Share \n"
+     << "----------------+-------------+-------------+--------\n";
+
+  for (int i = 0; i < PROFILE_STAGE_NB; ++i)
+      ss << std::setw(15) << Names[i] << " | " << std::setw(11) << p.calls[i]
+         << " | " << std::setw(11) << double(p.ticks[i]) / std::max(p.calls[i], uint64_t(1))
+         << " | " << std::setw(5) << 100.0 * p.ticks[i] / std::max(total, uint64_t(1)) << "%\n";
+
+  return ss.str();
+}
+
+
+/// piece_terms() returns the contribution of piece 'pc' on square 's' to the
+/// evaluation terms that are updated incrementally in do_move(), from the white
+/// point of view. These terms depend only on the piece and on the square 'ksq'
+/// of its own king, so a move that is not a king move only pays for the delta.
+
+Score Eval::piece_terms(Piece pc, Square s, Square ksq) {
+
+  PieceType pt = type_of(pc);
+
+  if (pt < KNIGHT || pt > QUEEN)
+      return SCORE_ZERO;
+
+  Score v = KingProtector[pt - 2] * distance(s, ksq);
+
+  return color_of(pc) == WHITE ? v : -v;
 }
 
+
+/// compute_terms() computes the incrementally updated terms from scratch. It
+/// is used when a new position is set up, after a king move, and to verify the
+/// incremental update in debug mode.
+
+Score Eval::compute_terms(const Position& pos) {
+
+  Score score = SCORE_ZERO;
+
+  for (Bitboard b = pos.pieces() ^ pos.pieces(PAWN, KING); b; )
+  {
+      Square s = pop_lsb(&b);
+      Piece pc = pos.piece_on(s);
+      score += piece_terms(pc, s, pos.square<KING>(color_of(pc)));
+  }
+
+  return score;
+}
+
+
 /// trace() is like evaluate(), but instead of returning a value, it returns
 /// a string (suitable for outputting to stdout) that contains the detailed
 /// descriptions and values of each evaluation term. Useful for debugging.
@@ -929,5 +1086,12 @@ std::string Eval::trace(const Position& pos) {
 
   ss << "\nTotal Evaluation: " << to_cp(v) << " (white side)\n";
 
+  if (NNUE::Enabled)
+  {
+      v = NNUE::evaluate(pos);
+      v = pos.side_to_move() == WHITE ? v : -v;
+      ss << "NNUE evaluation : " << to_cp(v) << " (white side)\n";
+  }
+
   return ss.str();
 }
@@ -22,7 +22,9 @@
 #define EVALUATE_H_INCLUDED
 
 #include <string>
+#include <vector>
 
+#include "misc.h"
 #include "types.h"
 
 class Position;
@@ -31,9 +33,48 @@ namespace Eval {
 
 const Value Tempo = Value(20); // Must be visible to search
 
+/// Eval::Entry is an entry of the per-thread evaluation cache, storing the
+/// final evaluation of the position with the given key. The cache is compiled
+/// in only with -DUSE_EVAL_CACHE, otherwise the table has a single entry.
+
+struct Entry {
+  Key key;
+  Value value;
+};
+
+typedef HashTable<Entry, HasEvalCache ? 8192 : 1> Table;
+
+/// Eval::Profile counts, for each stage of the evaluation, the number of times
+/// it has been run and the time spent in it, in CPU ticks. It is filled only
+/// with -DUSE_EVAL_PROFILE.
+
+enum ProfileStage {
+  PROFILE_MATERIAL, PROFILE_PAWNS, PROFILE_INITIALIZE, PROFILE_KNIGHTS,
+  PROFILE_BISHOPS, PROFILE_ROOKS, PROFILE_QUEENS, PROFILE_KING, PROFILE_THREATS,
+  PROFILE_PASSED, PROFILE_SPACE, PROFILE_SCALE, PROFILE_STAGE_NB
+};
+
+struct Profile {
+
+  Profile& operator+=(const Profile& p) {
+    for (int i = 0; i < PROFILE_STAGE_NB; ++i)
+        calls[i] += p.calls[i], ticks[i] += p.ticks[i];
+    return *this;
+  }
+
+  uint64_t calls[PROFILE_STAGE_NB];
+  uint64_t ticks[PROFILE_STAGE_NB];
+};
+
+std::string profile(const Profile& p);
+
 std::string trace(const Position& pos);
 
 Value evaluate(const Position& pos);
+void evaluate_batch(const std::vector<std::string>& fens, Value* values, bool chess960);
+
+Score piece_terms(Piece pc, Square s, Square ksq);
+Score compute_terms(const Position& pos);
 }
 
 #endif // #ifndef EVALUATE_H_INCLUDED
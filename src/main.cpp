@@ -21,6 +21,7 @@
 #include <iostream>
 
 #include "bitboard.h"
+#include "nnue.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -33,6 +34,8 @@ namespace PSQT {
 
 int main(int argc, char* argv[]) {
 
+  CPU::init();
+
   std::cout << engine_info() << std::endl;
 
   UCI::init(Options);
@@ -42,10 +45,14 @@ int main(int argc, char* argv[]) {
   Bitbases::init();
   Search::init();
   Pawns::init();
+  Material::init();
+  NNUE::init();
   Threads.init();
 
   UCI::loop(argc, argv);
 
   Threads.exit();
+  Bitbases::wait();
+  Tablebases::stop_mapping();
   return 0;
 }
@@ -20,15 +20,53 @@
 
 #include <algorithm> // For std::min
 #include <cassert>
+#include <chrono>
 #include <cstring>   // For std::memset
+#include <memory>    // For std::unique_ptr
+#include <thread>
+#include <vector>
 
 #include "material.h"
 #include "thread.h"
 
 using namespace std;
 
+namespace Zobrist {
+  extern Key psq[PIECE_NB][SQUARE_NB];
+}
+
 namespace {
 
+  // The shared table covers up to 8 pawns, 2 knights, 2 bishops, 2 rooks and
+  // 1 queen per side, which is SideConfigs configurations for each color.
+  const int SideConfigs = 9 * 3 * 3 * 3 * 2;
+
+  vector<Material::Entry> SharedTable;
+  unique_ptr<Endgames> SharedEndgames;
+
+  // Config holds the piece counts of a material configuration, with the same
+  // accessors as a Position, so that an Entry can be computed without one.
+  struct Config {
+
+    template<PieceType Pt> int count(Color c) const { return cnt[c][Pt]; }
+
+    Value non_pawn_material(Color c) const {
+      return  cnt[c][KNIGHT] * KnightValueMg + cnt[c][BISHOP] * BishopValueMg
+            + cnt[c][ROOK] * RookValueMg + cnt[c][QUEEN] * QueenValueMg;
+    }
+
+    Key key() const {
+      Key k = 0;
+      for (Color c = WHITE; c <= BLACK; ++c)
+          for (PieceType pt = PAWN; pt <= KING; ++pt)
+              for (int i = 0; i < cnt[c][pt]; ++i)
+                  k ^= Zobrist::psq[make_piece(c, pt)][i];
+      return k;
+    }
+
+    int cnt[COLOR_NB][PIECE_TYPE_NB]; // cnt[c][ALL_PIECES] includes the king
+  };
+
   // Polynomial material imbalance parameters
 
   const int QuadraticOurs[][PIECE_TYPE_NB] = {
@@ -64,28 +102,19 @@ namespace {
     31, -8, -15, -25, -5
   };
 
-  // Endgame evaluation and scaling functions are accessed directly and not through
-  // the function maps because they correspond to more than one material hash key.
-  Endgame<KXK>    EvaluateKXK[] = { Endgame<KXK>(WHITE),    Endgame<KXK>(BLACK) };
-
-  Endgame<KBPsK>  ScaleKBPsK[]  = { Endgame<KBPsK>(WHITE),  Endgame<KBPsK>(BLACK) };
-  Endgame<KQKRPs> ScaleKQKRPs[] = { Endgame<KQKRPs>(WHITE), Endgame<KQKRPs>(BLACK) };
-  Endgame<KPsK>   ScaleKPsK[]   = { Endgame<KPsK>(WHITE),   Endgame<KPsK>(BLACK) };
-  Endgame<KPKP>   ScaleKPKP[]   = { Endgame<KPKP>(WHITE),   Endgame<KPKP>(BLACK) };
-
   // Helper used to detect a given material distribution
-  bool is_KXK(const Position& pos, Color us) {
-    return  !more_than_one(pos.pieces(~us))
+  bool is_KXK(const Config& pos, Color us) {
+    return   pos.count<ALL_PIECES>(~us) == 1
           && pos.non_pawn_material(us) >= RookValueMg;
   }
 
-  bool is_KBPsKs(const Position& pos, Color us) {
+  bool is_KBPsKs(const Config& pos, Color us) {
     return   pos.non_pawn_material(us) == BishopValueMg
           && pos.count<BISHOP>(us) == 1
           && pos.count<PAWN  >(us) >= 1;
   }
 
-  bool is_KQKRPs(const Position& pos, Color us) {
+  bool is_KQKRPs(const Config& pos, Color us) {
     return  !pos.count<PAWN>(us)
           && pos.non_pawn_material(us) == QueenValueMg
           && pos.count<QUEEN>(us)  == 1
@@ -124,119 +153,254 @@ namespace {
     return bonus;
   }
 
+  // compute() fills the Entry of the given material configuration
+
+  void compute(Material::Entry* e, const Config& pos, Key key) {
+
+    const Endgames& endgames = *SharedEndgames;
+
+    std::memset(e, 0, sizeof(Material::Entry));
+    e->key = key;
+    e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
+
+    Value npm_w = pos.non_pawn_material(WHITE);
+    Value npm_b = pos.non_pawn_material(BLACK);
+    Value npm = std::max(EndgameLimit, std::min(npm_w + npm_b, MidgameLimit));
+
+    // Map total non-pawn material into [PHASE_ENDGAME, PHASE_MIDGAME]
+    e->gamePhase = Phase(((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit));
+
+    // Let's look if we have a specialized evaluation function for this particular
+    // material configuration. Firstly we look for a fixed configuration one, then
+    // for a generic one if the previous search failed.
+    const Endgames::Entry* eg = endgames.probe(key);
+
+    if (eg && eg->code < SCALING_FUNCTIONS)
+    {
+        e->evaluationFunction = uint8_t(eg->code);
+        e->evaluationSide = uint8_t(eg->strongSide);
+        return;
+    }
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+        if (is_KXK(pos, c))
+        {
+            e->evaluationFunction = uint8_t(KXK);
+            e->evaluationSide = uint8_t(c);
+            return;
+        }
+
+    // OK, we didn't find any special evaluation function for the current material
+    // configuration. Is there a suitable specialized scaling function?
+    if (eg)
+    {
+        e->scalingFunction[eg->strongSide] = uint8_t(eg->code); // Only strong color assigned
+        return;
+    }
+
+    // We didn't find any specialized scaling function, so fall back on generic
+    // ones that refer to more than one material distribution. Note that in this
+    // case we don't return after setting the function.
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+      if (is_KBPsKs(pos, c))
+          e->scalingFunction[c] = uint8_t(KBPsK);
+
+      else if (is_KQKRPs(pos, c))
+          e->scalingFunction[c] = uint8_t(KQKRPs);
+    }
+
+    if (npm_w + npm_b == VALUE_ZERO && pos.count<PAWN>(WHITE) + pos.count<PAWN>(BLACK)) // Only pawns on the board
+    {
+        if (!pos.count<PAWN>(BLACK))
+        {
+            assert(pos.count<PAWN>(WHITE) >= 2);
+
+            e->scalingFunction[WHITE] = uint8_t(KPsK);
+        }
+        else if (!pos.count<PAWN>(WHITE))
+        {
+            assert(pos.count<PAWN>(BLACK) >= 2);
+
+            e->scalingFunction[BLACK] = uint8_t(KPsK);
+        }
+        else if (pos.count<PAWN>(WHITE) == 1 && pos.count<PAWN>(BLACK) == 1)
+        {
+            // This is a special case because we set scaling functions
+            // for both colors instead of only one.
+            e->scalingFunction[WHITE] = uint8_t(KPKP);
+            e->scalingFunction[BLACK] = uint8_t(KPKP);
+        }
+    }
+
+    // Zero or just one pawn makes it difficult to win, even with a small material
+    // advantage. This catches some trivial draws like KK, KBK and KNK and gives a
+    // drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
+    if (!pos.count<PAWN>(WHITE) && npm_w - npm_b <= BishopValueMg)
+        e->factor[WHITE] = uint8_t(npm_w <  RookValueMg   ? SCALE_FACTOR_DRAW :
+                                   npm_b <= BishopValueMg ? 4 : 14);
+
+    if (!pos.count<PAWN>(BLACK) && npm_b - npm_w <= BishopValueMg)
+        e->factor[BLACK] = uint8_t(npm_b <  RookValueMg   ? SCALE_FACTOR_DRAW :
+                                   npm_w <= BishopValueMg ? 4 : 14);
+
+    if (pos.count<PAWN>(WHITE) == 1 && npm_w - npm_b <= BishopValueMg)
+        e->factor[WHITE] = (uint8_t) SCALE_FACTOR_ONEPAWN;
+
+    if (pos.count<PAWN>(BLACK) == 1 && npm_b - npm_w <= BishopValueMg)
+        e->factor[BLACK] = (uint8_t) SCALE_FACTOR_ONEPAWN;
+
+    // Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
+    // for the bishop pair "extended piece", which allows us to be more flexible
+    // in defining bishop pair bonuses.
+    const int PieceCount[COLOR_NB][PIECE_TYPE_NB] = {
+    { pos.count<BISHOP>(WHITE) > 1, pos.count<PAWN>(WHITE), pos.count<KNIGHT>(WHITE),
+      pos.count<BISHOP>(WHITE)    , pos.count<ROOK>(WHITE), pos.count<QUEEN >(WHITE) },
+    { pos.count<BISHOP>(BLACK) > 1, pos.count<PAWN>(BLACK), pos.count<KNIGHT>(BLACK),
+      pos.count<BISHOP>(BLACK)    , pos.count<ROOK>(BLACK), pos.count<QUEEN >(BLACK) } };
+
+    e->value = int16_t((imbalance<WHITE>(PieceCount) - imbalance<BLACK>(PieceCount)) / 16);
+  }
+
+  // side_index() maps the counts of a color to [0, SideConfigs), or returns -1
+  // if the configuration is not covered by the shared table.
+  template<typename T>
+  int side_index(const T& pos, Color c) {
+
+    int n = pos.template count<KNIGHT>(c), b = pos.template count<BISHOP>(c),
+        r = pos.template count<ROOK>(c),   q = pos.template count<QUEEN>(c);
+
+    int p = pos.template count<PAWN>(c);
+
+    if (p > 8 || n > 2 || b > 2 || r > 2 || q > 1)
+        return -1;
+
+    return (((p * 3 + n) * 3 + b) * 3 + r) * 2 + q;
+  }
+
+  // config() is the inverse of side_index(), returning the material
+  // configuration of the given shared table index.
+  Config config(size_t idx) {
+
+    Config cfg;
+    int side[] = { int(idx / SideConfigs), int(idx % SideConfigs) };
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        int i = side[c];
+        cfg.cnt[c][QUEEN]  = i % 2; i /= 2;
+        cfg.cnt[c][ROOK]   = i % 3; i /= 3;
+        cfg.cnt[c][BISHOP] = i % 3; i /= 3;
+        cfg.cnt[c][KNIGHT] = i % 3; i /= 3;
+        cfg.cnt[c][PAWN]   = i;
+        cfg.cnt[c][KING]   = 1;
+        cfg.cnt[c][ALL_PIECES] = 1 + cfg.cnt[c][PAWN] + cfg.cnt[c][KNIGHT]
+                               + cfg.cnt[c][BISHOP] + cfg.cnt[c][ROOK] + cfg.cnt[c][QUEEN];
+    }
+
+    return cfg;
+  }
+
+  // Fills the shared table entries in [begin, end) from their indices
+  void fill_range(size_t begin, size_t end) {
+
+    for (size_t idx = begin; idx < end; ++idx)
+    {
+        Config cfg = config(idx);
+        compute(&SharedTable[idx], cfg, cfg.key());
+    }
+  }
+
 } // namespace
 
 namespace Material {
 
-/// Material::probe() looks up the current position's material configuration in
-/// the material hash table. It returns a pointer to the Entry if the position
-/// is found. Otherwise a new Entry is computed and stored there, so we don't
-/// have to recompute all when the same material configuration occurs again.
+/// Material::init() precomputes the entries of all the material configurations
+/// covered by the shared table. The table is read-only afterwards, so all the
+/// search threads share it. The work is split among the available cores.
 
-Entry* probe(const Position& pos) {
+void init() {
 
-  Key key = pos.material_key();
-  Entry* e = pos.this_thread()->materialTable[key];
+  SharedEndgames.reset(new Endgames());
+  SharedTable.resize(size_t(SideConfigs) * SideConfigs);
 
-  if (e->key == key)
-      return e;
+  size_t workers = std::max(1U, std::thread::hardware_concurrency());
+  size_t chunk = (SharedTable.size() + workers - 1) / workers;
+  std::vector<std::thread> threads;
+
+  for (size_t i = 1; i < workers; ++i)
+      threads.emplace_back(fill_range, std::min(i * chunk, SharedTable.size()),
+                                       std::min((i + 1) * chunk, SharedTable.size()));
 
-  std::memset(e, 0, sizeof(Entry));
-  e->key = key;
-  e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
+  fill_range(0, std::min(chunk, SharedTable.size()));
 
-  Value npm_w = pos.non_pawn_material(WHITE);
-  Value npm_b = pos.non_pawn_material(BLACK);
-  Value npm = std::max(EndgameLimit, std::min(npm_w + npm_b, MidgameLimit));
+  for (std::thread& th : threads)
+      th.join();
+}
 
-  // Map total non-pawn material into [PHASE_ENDGAME, PHASE_MIDGAME]
-  e->gamePhase = Phase(((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit));
 
-  // Let's look if we have a specialized evaluation function for this particular
-  // material configuration. Firstly we look for a fixed configuration one, then
-  // for a generic one if the previous search failed.
-  if ((e->evaluationFunction = pos.this_thread()->endgames.probe<Value>(key)) != nullptr)
-      return e;
+/// Material::miss_cost() returns the average time in nanoseconds to compute an
+/// Entry from scratch, which is what a miss used to cost before the table was
+/// precomputed. It is measured over all the configurations of the shared table.
 
-  for (Color c = WHITE; c <= BLACK; ++c)
-      if (is_KXK(pos, c))
-      {
-          e->evaluationFunction = &EvaluateKXK[c];
-          return e;
-      }
+double miss_cost() {
 
-  // OK, we didn't find any special evaluation function for the current material
-  // configuration. Is there a suitable specialized scaling function?
-  EndgameBase<ScaleFactor>* sf;
+  Entry e;
+  int sum = 0;
+  auto start = std::chrono::steady_clock::now();
 
-  if ((sf = pos.this_thread()->endgames.probe<ScaleFactor>(key)) != nullptr)
+  for (size_t idx = 0; idx < SharedTable.size(); ++idx)
   {
-      e->scalingFunction[sf->strongSide] = sf; // Only strong color assigned
-      return e;
+      Config cfg = config(idx);
+      compute(&e, cfg, cfg.key());
+      sum += e.value;
   }
 
-  // We didn't find any specialized scaling function, so fall back on generic
-  // ones that refer to more than one material distribution. Note that in this
-  // case we don't return after setting the function.
-  for (Color c = WHITE; c <= BLACK; ++c)
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  volatile int sink = sum; // Keep the loop from being optimized away
+  (void)sink;
+
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())
+        / SharedTable.size();
+}
+
+
+/// Material::probe() returns the Entry of the current position's material
+/// configuration. Common configurations are read from the shared table, the
+/// rare ones (e.g. after an underpromotion) are computed and stored in the
+/// small per-thread hash table, so we don't have to recompute all when the same
+/// material configuration occurs again.
+
+Entry* probe(const Position& pos) {
+
+  int w = side_index(pos, WHITE), b = side_index(pos, BLACK);
+
+  if (w >= 0 && b >= 0)
   {
-    if (is_KBPsKs(pos, c))
-        e->scalingFunction[c] = &ScaleKBPsK[c];
+      assert(SharedTable[w * SideConfigs + b].key == pos.material_key());
 
-    else if (is_KQKRPs(pos, c))
-        e->scalingFunction[c] = &ScaleKQKRPs[c];
+      return &SharedTable[w * SideConfigs + b];
   }
 
-  if (npm_w + npm_b == VALUE_ZERO && pos.pieces(PAWN)) // Only pawns on the board
+  Key key = pos.material_key();
+  Entry* e = pos.this_thread()->materialTable[key];
+
+  if (e->key == key)
+      return e;
+
+  Config cfg;
+  for (Color c = WHITE; c <= BLACK; ++c)
   {
-      if (!pos.count<PAWN>(BLACK))
-      {
-          assert(pos.count<PAWN>(WHITE) >= 2);
-
-          e->scalingFunction[WHITE] = &ScaleKPsK[WHITE];
-      }
-      else if (!pos.count<PAWN>(WHITE))
-      {
-          assert(pos.count<PAWN>(BLACK) >= 2);
-
-          e->scalingFunction[BLACK] = &ScaleKPsK[BLACK];
-      }
-      else if (pos.count<PAWN>(WHITE) == 1 && pos.count<PAWN>(BLACK) == 1)
-      {
-          // This is a special case because we set scaling functions
-          // for both colors instead of only one.
-          e->scalingFunction[WHITE] = &ScaleKPKP[WHITE];
-          e->scalingFunction[BLACK] = &ScaleKPKP[BLACK];
-      }
+      cfg.cnt[c][PAWN]   = pos.count<PAWN>(c);
+      cfg.cnt[c][KNIGHT] = pos.count<KNIGHT>(c);
+      cfg.cnt[c][BISHOP] = pos.count<BISHOP>(c);
+      cfg.cnt[c][ROOK]   = pos.count<ROOK>(c);
+      cfg.cnt[c][QUEEN]  = pos.count<QUEEN>(c);
+      cfg.cnt[c][KING]   = pos.count<KING>(c);
+      cfg.cnt[c][ALL_PIECES] = pos.count<ALL_PIECES>(c);
   }
 
-  // Zero or just one pawn makes it difficult to win, even with a small material
-  // advantage. This catches some trivial draws like KK, KBK and KNK and gives a
-  // drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
-  if (!pos.count<PAWN>(WHITE) && npm_w - npm_b <= BishopValueMg)
-      e->factor[WHITE] = uint8_t(npm_w <  RookValueMg   ? SCALE_FACTOR_DRAW :
-                                 npm_b <= BishopValueMg ? 4 : 14);
-
-  if (!pos.count<PAWN>(BLACK) && npm_b - npm_w <= BishopValueMg)
-      e->factor[BLACK] = uint8_t(npm_b <  RookValueMg   ? SCALE_FACTOR_DRAW :
-                                 npm_w <= BishopValueMg ? 4 : 14);
-
-  if (pos.count<PAWN>(WHITE) == 1 && npm_w - npm_b <= BishopValueMg)
-      e->factor[WHITE] = (uint8_t) SCALE_FACTOR_ONEPAWN;
-
-  if (pos.count<PAWN>(BLACK) == 1 && npm_b - npm_w <= BishopValueMg)
-      e->factor[BLACK] = (uint8_t) SCALE_FACTOR_ONEPAWN;
-
-  // Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
-  // for the bishop pair "extended piece", which allows us to be more flexible
-  // in defining bishop pair bonuses.
-  const int PieceCount[COLOR_NB][PIECE_TYPE_NB] = {
-  { pos.count<BISHOP>(WHITE) > 1, pos.count<PAWN>(WHITE), pos.count<KNIGHT>(WHITE),
-    pos.count<BISHOP>(WHITE)    , pos.count<ROOK>(WHITE), pos.count<QUEEN >(WHITE) },
-  { pos.count<BISHOP>(BLACK) > 1, pos.count<PAWN>(BLACK), pos.count<KNIGHT>(BLACK),
-    pos.count<BISHOP>(BLACK)    , pos.count<ROOK>(BLACK), pos.count<QUEEN >(BLACK) } };
-
-  e->value = int16_t((imbalance<WHITE>(PieceCount) - imbalance<BLACK>(PieceCount)) / 16);
+  compute(e, cfg, key);
   return e;
 }
 
@@ -29,9 +29,9 @@
 namespace Material {
 
 /// Material::Entry contains various information about a material configuration.
-/// It contains a material imbalance evaluation, a function pointer to a special
-/// endgame evaluation function (which in most cases is NULL, meaning that the
-/// standard evaluation function will be used), and scale factors.
+/// It contains a material imbalance evaluation, the code of a special endgame
+/// evaluation function (which in most cases is EVALUATION_FUNCTIONS, meaning
+/// that the standard evaluation function will be used), and scale factors.
 ///
 /// The scale factors are used to scale the evaluation score up or down. For
 /// instance, in KRB vs KR endgames, the score is scaled down by a factor of 4,
@@ -41,8 +41,10 @@ struct Entry {
 
   Score imbalance() const { return make_score(value, value); }
   Phase game_phase() const { return gamePhase; }
-  bool specialized_eval_exists() const { return evaluationFunction != nullptr; }
-  Value evaluate(const Position& pos) const { return (*evaluationFunction)(pos); }
+  bool specialized_eval_exists() const { return evaluationFunction != EVALUATION_FUNCTIONS; }
+  Value evaluate(const Position& pos) const {
+    return Endgames::evaluate(EndgameCode(evaluationFunction), Color(evaluationSide), pos);
+  }
 
   // scale_factor takes a position and a color as input and returns a scale factor
   // for the given color. We have to provide the position in addition to the color
@@ -50,22 +52,25 @@ struct Entry {
   // the position. For instance, in KBP vs K endgames, the scaling function looks
   // for rook pawns and wrong-colored bishops.
   ScaleFactor scale_factor(const Position& pos, Color c) const {
-    ScaleFactor sf = scalingFunction[c] ? (*scalingFunction[c])(pos)
-                                        :  SCALE_FACTOR_NONE;
+    ScaleFactor sf = scalingFunction[c] ? Endgames::scale_factor(EndgameCode(scalingFunction[c]), c, pos)
+                                        : SCALE_FACTOR_NONE;
     return sf != SCALE_FACTOR_NONE ? sf : ScaleFactor(factor[c]);
   }
 
   Key key;
-  EndgameBase<Value>* evaluationFunction;
-  EndgameBase<ScaleFactor>* scalingFunction[COLOR_NB]; // Could be one for each
-                                                       // side (e.g. KPKP, KBPsKs)
+  uint8_t evaluationFunction; // EndgameCode, EVALUATION_FUNCTIONS if none
+  uint8_t evaluationSide;     // Strong side of the evaluation function
+  uint8_t scalingFunction[COLOR_NB]; // Could be one for each side (e.g. KPKP,
+                                     // KBPsKs), zero if none
   int16_t value;
   uint8_t factor[COLOR_NB];
   Phase gamePhase;
 };
 
-typedef HashTable<Entry, 8192> Table;
+typedef HashTable<Entry, 64> Table;
 
+void init();
+double miss_cost();
 Entry* probe(const Position& pos);
 
 } // namespace Material
@@ -36,6 +36,17 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 }
 #endif
 
+#if defined(USE_DISPATCH)
+#include <cpuid.h>
+#endif
+
+#if defined(_MSC_VER)
+#  include <intrin.h>    // For __rdtsc()
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <x86intrin.h> // For __rdtsc()
+#endif
+
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -132,6 +143,7 @@ const string engine_info(bool to_uci) {
 
   ss << (Is64Bit ? " 64" : "")
      << (HasPext ? " BMI2" : (HasPopCnt ? " POPCNT" : ""))
+     << (HasAvx2 ? " AVX2" : "")
      << (to_uci  ? "\nid author ": " by ")
      << "T. Romstad, M. Costalba, J. Kiiski, G. Linscott";
 
@@ -205,6 +217,19 @@ void prefetch(void* addr) {
 
 #endif
 
+/// ticks() reads the time stamp counter, used by the profilers, or a nanosecond
+/// clock where there is none.
+
+uint64_t ticks() {
+
+#if defined(_MSC_VER) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>
+        (std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
 void prefetch2(void* addr) {
 
   prefetch(addr);
@@ -323,3 +348,62 @@ void bindThisThread(size_t idx) {
 #endif
 
 } // namespace WinProcGroup
+
+#if defined(USE_DISPATCH)
+
+bool HasPopCnt, HasPext, HasAvx2;
+
+#endif
+
+namespace CPU {
+
+#if !defined(USE_DISPATCH)
+
+void init() {}
+
+#else
+
+/// init() queries cpuid and sets the HasPopCnt, HasPext and HasAvx2 globals.
+/// Pext is not used on AMD processors before Zen 3, where the instruction is
+/// microcoded and much slower than a plain magic multiplication.
+
+void init() {
+
+  unsigned eax = 0, ebx = 0, ecx = 0, edx = 0, maxLeaf = 0;
+  char vendor[13] = {};
+
+  __get_cpuid(0, &maxLeaf, &ebx, &ecx, &edx);
+  std::memcpy(vendor + 0, &ebx, 4);
+  std::memcpy(vendor + 4, &edx, 4);
+  std::memcpy(vendor + 8, &ecx, 4);
+
+  __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+
+  unsigned family = (eax >> 8) & 0xF;
+  if (family == 0xF)
+      family += (eax >> 20) & 0xFF;
+
+  HasPopCnt = ecx & bit_POPCNT;
+
+  // AVX state must also be enabled by the OS, as reported by xgetbv
+  bool osAvx = false;
+  if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX))
+  {
+      unsigned xcr0, xcr0hi;
+      __asm__("xgetbv" : "=a" (xcr0), "=d" (xcr0hi) : "c" (0));
+      osAvx = (xcr0 & 6) == 6;
+  }
+
+  if (maxLeaf >= 7)
+  {
+      __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+
+      HasAvx2 = osAvx && (ebx & bit_AVX2);
+      HasPext =   (ebx & bit_BMI2)
+               && !(std::strcmp(vendor, "AuthenticAMD") == 0 && family < 0x19);
+  }
+}
+
+#endif
+
+} // namespace CPU
@@ -32,6 +32,7 @@
 const std::string engine_info(bool to_uci = false);
 void prefetch(void* addr);
 void prefetch2(void* addr);
+uint64_t ticks();
 void start_logger(const std::string& fname);
 
 void dbg_hit_on(bool b);
@@ -109,4 +110,13 @@ namespace WinProcGroup {
   void bindThisThread(size_t idx);
 }
 
+
+/// CPU::init() detects at startup the instruction set extensions used by the
+/// hot code paths when the engine is built with -DUSE_DISPATCH. It must be
+/// called before any other initialization. In other builds it does nothing.
+
+namespace CPU {
+  void init();
+}
+
 #endif // #ifndef MISC_H_INCLUDED
@@ -18,6 +18,7 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
 
 #include "movegen.h"
@@ -216,8 +217,14 @@ namespace {
 
             assert(b1);
 
+            // En passant captures can uncover a check along the rank of the
+            // two pawns, this is rare enough to be simply tested with legal().
             while (b1)
-                *moveList++ = make<ENPASSANT>(pop_lsb(&b1), pos.ep_square());
+            {
+                Move m = make<ENPASSANT>(pop_lsb(&b1), pos.ep_square());
+                if (pos.legal(m))
+                    *moveList++ = m;
+            }
         }
     }
 
@@ -232,6 +239,7 @@ namespace {
     assert(Pt != KING && Pt != PAWN);
 
     const Square* pl = pos.squares<Pt>(us);
+    Bitboard pinned = pos.pinned_pieces(us);
 
     for (Square from = *pl; from != SQ_NONE; from = *++pl)
     {
@@ -247,6 +255,10 @@ namespace {
 
         Bitboard b = pos.attacks_from<Pt>(from) & target;
 
+        // A pinned piece can only move along the line through our king
+        if (pinned & from)
+            b &= LineBB[pos.square<KING>(us)][from];
+
         if (Checks)
             b &= pos.check_squares(Pt);
 
@@ -263,7 +275,20 @@ namespace {
 
     const bool Checks = Type == QUIET_CHECKS;
 
+    ExtMove* pawnMoves = moveList;
     moveList = generate_pawn_moves<Us, Type>(pos, moveList, target);
+
+    // Pawn moves are generated in bulk, so drop the ones of pinned pawns
+    // that leave the line through our king.
+    Bitboard pinnedPawns = pos.pinned_pieces(Us) & pos.pieces(Us, PAWN);
+    if (pinnedPawns)
+    {
+        Square ksq = pos.square<KING>(Us);
+        moveList = std::remove_if(pawnMoves, moveList, [=](const ExtMove& m) {
+            return (pinnedPawns & from_sq(m)) && !aligned(from_sq(m), to_sq(m), ksq);
+        });
+    }
+
     moveList = generate_moves<KNIGHT, Checks>(pos, moveList, Us, target);
     moveList = generate_moves<BISHOP, Checks>(pos, moveList, Us, target);
     moveList = generate_moves<  ROOK, Checks>(pos, moveList, Us, target);
@@ -274,7 +299,11 @@ namespace {
         Square ksq = pos.square<KING>(Us);
         Bitboard b = pos.attacks_from<KING>(ksq) & target;
         while (b)
-            *moveList++ = make_move(ksq, pop_lsb(&b));
+        {
+            Square to = pop_lsb(&b);
+            if (!(pos.attackers_to(to) & pos.pieces(~Us)))
+                *moveList++ = make_move(ksq, to);
+        }
     }
 
     if (Type != CAPTURES && Type != EVASIONS && pos.can_castle(Us))
@@ -297,14 +326,18 @@ namespace {
 } // namespace
 
 
-/// generate<CAPTURES> generates all pseudo-legal captures and queen
-/// promotions. Returns a pointer to the end of the move list.
+/// generate<CAPTURES> generates all legal captures and queen promotions.
+/// Returns a pointer to the end of the move list.
+///
+/// generate<QUIETS> generates all legal non-captures and underpromotions.
+/// Returns a pointer to the end of the move list.
 ///
-/// generate<QUIETS> generates all pseudo-legal non-captures and
-/// underpromotions. Returns a pointer to the end of the move list.
+/// generate<NON_EVASIONS> generates all legal captures and non-captures.
+/// Returns a pointer to the end of the move list.
 ///
-/// generate<NON_EVASIONS> generates all pseudo-legal captures and
-/// non-captures. Returns a pointer to the end of the move list.
+/// All the generators emit only legal moves: pinned pieces are restricted to
+/// the line through their king using the pin information in StateInfo, and
+/// king moves to attacked squares are not generated.
 
 template<GenType Type>
 ExtMove* generate(const Position& pos, ExtMove* moveList) {
@@ -328,7 +361,7 @@ template ExtMove* generate<QUIETS>(const Position&, ExtMove*);
 template ExtMove* generate<NON_EVASIONS>(const Position&, ExtMove*);
 
 
-/// generate<QUIET_CHECKS> generates all pseudo-legal non-captures and knight
+/// generate<QUIET_CHECKS> generates all legal non-captures and knight
 /// underpromotions that give check. Returns a pointer to the end of the move list.
 template<>
 ExtMove* generate<QUIET_CHECKS>(const Position& pos, ExtMove* moveList) {
@@ -336,6 +369,7 @@ ExtMove* generate<QUIET_CHECKS>(const Position& pos, ExtMove* moveList) {
   assert(!pos.checkers());
 
   Color us = pos.side_to_move();
+  Square ksq = pos.square<KING>(us);
   Bitboard dc = pos.discovered_check_candidates();
 
   while (dc)
@@ -351,8 +385,15 @@ ExtMove* generate<QUIET_CHECKS>(const Position& pos, ExtMove* moveList) {
      if (pt == KING)
          b &= ~PseudoAttacks[QUEEN][pos.square<KING>(~us)];
 
+     else if (pos.pinned_pieces(us) & from)
+         b &= LineBB[ksq][from];
+
      while (b)
-         *moveList++ = make_move(from, pop_lsb(&b));
+     {
+         Square to = pop_lsb(&b);
+         if (pt != KING || !(pos.attackers_to(to) & pos.pieces(~us)))
+             *moveList++ = make_move(from, to);
+     }
   }
 
   return us == WHITE ? generate_all<WHITE, QUIET_CHECKS>(pos, moveList, ~pos.pieces())
@@ -360,8 +401,8 @@ ExtMove* generate<QUIET_CHECKS>(const Position& pos, ExtMove* moveList) {
 }
 
 
-/// generate<EVASIONS> generates all pseudo-legal check evasions when the side
-/// to move is in check. Returns a pointer to the end of the move list.
+/// generate<EVASIONS> generates all legal check evasions when the side to move
+/// is in check. Returns a pointer to the end of the move list.
 template<>
 ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList) {
 
@@ -384,7 +425,11 @@ ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList) {
   // Generate evasions for king, capture and non capture moves
   Bitboard b = pos.attacks_from<KING>(ksq) & ~pos.pieces(us) & ~sliderAttacks;
   while (b)
-      *moveList++ = make_move(ksq, pop_lsb(&b));
+  {
+      Square to = pop_lsb(&b);
+      if (!(pos.attackers_to(to) & pos.pieces(~us)))
+          *moveList++ = make_move(ksq, to);
+  }
 
   if (more_than_one(pos.checkers()))
       return moveList; // Double check, only a king move can save the day
@@ -403,18 +448,6 @@ ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList) {
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 
-  Bitboard pinned = pos.pinned_pieces(pos.side_to_move());
-  Square ksq = pos.square<KING>(pos.side_to_move());
-  ExtMove* cur = moveList;
-
-  moveList = pos.checkers() ? generate<EVASIONS    >(pos, moveList)
-                            : generate<NON_EVASIONS>(pos, moveList);
-  while (cur != moveList)
-      if (   (pinned || from_sq(*cur) == ksq || type_of(*cur) == ENPASSANT)
-          && !pos.legal(*cur))
-          *cur = (--moveList)->move;
-      else
-          ++cur;
-
-  return moveList;
+  return pos.checkers() ? generate<EVASIONS    >(pos, moveList)
+                        : generate<NON_EVASIONS>(pos, moveList);
 }
@@ -78,7 +78,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, Search::Stack* s)
   killers[1] = ss->killers[1];
 
   stage = pos.checkers() ? EVASION : MAIN_SEARCH;
-  ttMove = ttm && pos.pseudo_legal(ttm) ? ttm : MOVE_NONE;
+  ttMove = ttm && pos.pseudo_legal(ttm) && pos.legal(ttm) ? ttm : MOVE_NONE;
   stage += (ttMove == MOVE_NONE);
 }
 
@@ -103,7 +103,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, Square s)
       return;
   }
 
-  ttMove = ttm && pos.pseudo_legal(ttm) ? ttm : MOVE_NONE;
+  ttMove = ttm && pos.pseudo_legal(ttm) && pos.legal(ttm) ? ttm : MOVE_NONE;
   stage += (ttMove == MOVE_NONE);
 }
 
@@ -117,6 +117,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Value th)
   // In ProbCut we generate captures with SEE higher than or equal to the given threshold
   ttMove =   ttm
           && pos.pseudo_legal(ttm)
+          && pos.legal(ttm)
           && pos.capture(ttm)
           && pos.see_ge(ttm, threshold) ? ttm : MOVE_NONE;
 
@@ -215,6 +216,7 @@ Move MovePicker::next_move(bool skipQuiets) {
       if (    move != MOVE_NONE
           &&  move != ttMove
           &&  pos.pseudo_legal(move)
+          &&  pos.legal(move)
           && !pos.capture(move))
           return move;
       /* fallthrough */
@@ -225,6 +227,7 @@ Move MovePicker::next_move(bool skipQuiets) {
       if (    move != MOVE_NONE
           &&  move != ttMove
           &&  pos.pseudo_legal(move)
+          &&  pos.legal(move)
           && !pos.capture(move))
           return move;
       /* fallthrough */
@@ -237,6 +240,7 @@ Move MovePicker::next_move(bool skipQuiets) {
           &&  move != killers[0]
           &&  move != killers[1]
           &&  pos.pseudo_legal(move)
+          &&  pos.legal(move)
           && !pos.capture(move))
           return move;
       /* fallthrough */
@@ -0,0 +1,427 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>   // For std::memcpy
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(USE_DISPATCH)
+#  include <immintrin.h>
+#endif
+
+#include "misc.h"
+#include "nnue.h"
+#include "position.h"
+#include "uci.h"
+
+bool NNUE::Enabled = false; // Set by NNUE::init() from the UCI options
+
+namespace {
+
+  using namespace NNUE;
+
+  // Network file format, as written by the usual NNUE trainers. The hashes
+  // identify the architecture, so that a different network is rejected.
+  const uint32_t Version         = 0x7AF32F16u;
+  const uint32_t FileHash        = 0x3E5AA6EEu;
+  const uint32_t TransformerHash = 0x5D69D7B8u;
+  const uint32_t NetworkHash     = 0x63337156u;
+
+  // Feature index of a piece on a square, without the king square: 0 is
+  // unused, then 64 squares for each of the friendly and enemy non-king pieces.
+  const int PieceSquareNB = 10 * SQUARE_NB + 1;
+  const int FeatureNB     = SQUARE_NB * PieceSquareNB;
+
+  const int L1 = 32, L2 = 32;
+  const int WeightScaleBits = 6;
+  const int OutputScale = 16;
+
+  int PieceSquareIndex[COLOR_NB][PIECE_NB];
+
+  // Network parameters, in the order they are stored in the file
+  std::vector<int16_t> FtBiases, FtWeights;
+  std::vector<int32_t> L1Biases, L2Biases, OutBiases;
+  std::vector<int8_t>  L1Weights, L2Weights, OutWeights;
+
+  std::string LoadedFile;
+
+
+  // The features are seen from the point of view of 'perspective', so the
+  // board is rotated for black.
+  inline Square orient(Color perspective, Square s) {
+    return Square(int(s) ^ (perspective == WHITE ? 0 : 63));
+  }
+
+  inline int feature_index(Color perspective, Piece pc, Square s, Square ksq) {
+    return orient(perspective, s) + PieceSquareIndex[perspective][pc]
+                                  + PieceSquareNB * orient(perspective, ksq);
+  }
+
+
+  // affine() computes 'out' = 'biases' + 'weights' * 'in' for a layer with
+  // 'inDims' inputs, a multiple of 32, and 'outDims' outputs. The weights are
+  // stored row by row, one row for each output.
+
+#if !defined(__SSE2__) || !defined(NDEBUG)
+
+  void affine_scalar(const uint8_t* in, int32_t* out, const int8_t* weights,
+                     const int32_t* biases, int inDims, int outDims) {
+
+    for (int i = 0; i < outDims; ++i)
+    {
+        const int8_t* row = weights + i * inDims;
+        int32_t sum = biases[i];
+
+        for (int j = 0; j < inDims; ++j)
+            sum += row[j] * in[j];
+
+        out[i] = sum;
+    }
+  }
+
+#endif
+
+#if defined(__SSE2__)
+
+  void affine_sse2(const uint8_t* in, int32_t* out, const int8_t* weights,
+                   const int32_t* biases, int inDims, int outDims) {
+
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int i = 0; i < outDims; ++i)
+    {
+        const int8_t* row = weights + i * inDims;
+        __m128i sum = zero;
+
+        for (int j = 0; j < inDims; j += 16)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)(in + j));
+            __m128i w = _mm_loadu_si128((const __m128i*)(row + j));
+
+            // Widen to 16 bits: the inputs are unsigned, the weights are signed
+            __m128i xl = _mm_unpacklo_epi8(x, zero);
+            __m128i xh = _mm_unpackhi_epi8(x, zero);
+            __m128i wl = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8);
+            __m128i wh = _mm_srai_epi16(_mm_unpackhi_epi8(w, w), 8);
+
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(xl, wl));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(xh, wh));
+        }
+
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+        out[i] = biases[i] + _mm_cvtsi128_si32(sum);
+    }
+  }
+
+#endif
+
+#if defined(__AVX2__) || defined(USE_DISPATCH)
+
+#  if !defined(__AVX2__)
+  __attribute__((target("avx2")))
+#  endif
+  void affine_avx2(const uint8_t* in, int32_t* out, const int8_t* weights,
+                   const int32_t* biases, int inDims, int outDims) {
+
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    for (int i = 0; i < outDims; ++i)
+    {
+        const int8_t* row = weights + i * inDims;
+        __m256i sum = _mm256_setzero_si256();
+
+        // The products of pairs of inputs and weights are summed in 16 bits,
+        // which cannot overflow as both are at most 127 in absolute value.
+        for (int j = 0; j < inDims; j += 32)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(in + j));
+            __m256i w = _mm256_loadu_si256((const __m256i*)(row + j));
+            __m256i p = _mm256_maddubs_epi16(x, w);
+
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(p, ones));
+        }
+
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                  _mm256_extracti128_si256(sum, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        out[i] = biases[i] + _mm_cvtsi128_si32(s);
+    }
+  }
+
+#endif
+
+  void affine(const uint8_t* in, int32_t* out, const int8_t* weights,
+              const int32_t* biases, int inDims, int outDims) {
+
+#if defined(__AVX2__)
+    affine_avx2(in, out, weights, biases, inDims, outDims);
+#elif defined(USE_DISPATCH)
+    if (HasAvx2)
+        affine_avx2(in, out, weights, biases, inDims, outDims);
+    else
+        affine_sse2(in, out, weights, biases, inDims, outDims);
+#elif defined(__SSE2__)
+    affine_sse2(in, out, weights, biases, inDims, outDims);
+#else
+    affine_scalar(in, out, weights, biases, inDims, outDims);
+#endif
+
+#ifndef NDEBUG
+    // The scalar code is the reference for the vectorized versions
+    int32_t ref[L1]; // No layer has more outputs
+    affine_scalar(in, ref, weights, biases, inDims, outDims);
+    assert(std::equal(out, out + outDims, ref));
+#endif
+  }
+
+
+  // clipped_relu() scales down the output of a hidden layer and clamps it to
+  // the range of the inputs of the next one.
+
+  void clipped_relu(const int32_t* in, uint8_t* out, int dims) {
+
+    for (int i = 0; i < dims; ++i)
+        out[i] = uint8_t(std::max(0, std::min(127, in[i] >> WeightScaleBits)));
+  }
+
+
+  // add_feature() and sub_feature() update one half of the accumulator with the
+  // column of the feature transformer of a single feature.
+
+  void add_feature(int16_t* acc, int index) {
+
+    const int16_t* column = &FtWeights[index * HalfDimensions];
+
+    for (int j = 0; j < HalfDimensions; ++j)
+        acc[j] += column[j];
+  }
+
+  void sub_feature(int16_t* acc, int index) {
+
+    const int16_t* column = &FtWeights[index * HalfDimensions];
+
+    for (int j = 0; j < HalfDimensions; ++j)
+        acc[j] -= column[j];
+  }
+
+
+  // refresh() computes one half of the accumulator from scratch
+
+  void refresh(const Position& pos, Color perspective, int16_t* acc) {
+
+    Square ksq = pos.square<KING>(perspective);
+
+    std::memcpy(acc, &FtBiases[0], HalfDimensions * sizeof(int16_t));
+
+    for (Bitboard b = pos.pieces() ^ pos.pieces(KING); b; )
+    {
+        Square s = pop_lsb(&b);
+        add_feature(acc, feature_index(perspective, pos.piece_on(s), s, ksq));
+    }
+  }
+
+
+  // update_accumulator() computes the accumulator of the current position. When
+  // the previous one is available only the changed pieces are applied, unless
+  // the king of that perspective has moved and all its features have changed.
+
+  void update_accumulator(const Position& pos) {
+
+    StateInfo* st = pos.state();
+
+    if (st->accumulator.computed)
+        return;
+
+    StateInfo* prev = st->previous;
+    const DirtyPiece& dp = st->dirtyPiece;
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        int16_t* acc = st->accumulator.accumulation[c];
+
+        if (   !prev
+            || !prev->accumulator.computed
+            || (dp.dirtyNum && dp.piece[0] == make_piece(c, KING)))
+        {
+            refresh(pos, c, acc);
+            continue;
+        }
+
+        Square ksq = pos.square<KING>(c);
+
+        std::memcpy(acc, prev->accumulator.accumulation[c], HalfDimensions * sizeof(int16_t));
+
+        for (int i = 0; i < dp.dirtyNum; ++i)
+        {
+            if (type_of(dp.piece[i]) == KING)
+                continue;
+
+            if (dp.from[i] != SQ_NONE)
+                sub_feature(acc, feature_index(c, dp.piece[i], dp.from[i], ksq));
+
+            if (dp.to[i] != SQ_NONE)
+                add_feature(acc, feature_index(c, dp.piece[i], dp.to[i], ksq));
+        }
+    }
+
+    st->accumulator.computed = true;
+
+#ifndef NDEBUG
+    int16_t full[HalfDimensions];
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        refresh(pos, c, full);
+        assert(std::equal(full, full + HalfDimensions, st->accumulator.accumulation[c]));
+    }
+#endif
+  }
+
+
+  template<typename T>
+  bool read(std::istream& is, std::vector<T>& v, size_t n) {
+
+    v.resize(n);
+    return !!is.read((char*)&v[0], n * sizeof(T)); // Little-endian files and hosts
+  }
+
+  bool read_u32(std::istream& is, uint32_t expected) {
+
+    uint32_t v = 0;
+    return is.read((char*)&v, sizeof(v)) && v == expected;
+  }
+
+
+  // load() reads the network from a file and returns false if it is not in
+  // the expected format.
+
+  bool load(const std::string& fileName) {
+
+    std::ifstream is(fileName, std::ios::binary);
+    uint32_t size = 0;
+
+    if (   !read_u32(is, Version)
+        || !read_u32(is, FileHash)
+        || !is.read((char*)&size, sizeof(size))
+        || !is.ignore(size)) // Skip the description
+        return false;
+
+    return   read_u32(is, TransformerHash)
+          && read(is, FtBiases, HalfDimensions)
+          && read(is, FtWeights, size_t(FeatureNB) * HalfDimensions)
+          && read_u32(is, NetworkHash)
+          && read(is, L1Biases, L1)
+          && read(is, L1Weights, L1 * 2 * HalfDimensions)
+          && read(is, L2Biases, L2)
+          && read(is, L2Weights, L2 * L1)
+          && read(is, OutBiases, 1)
+          && read(is, OutWeights, L2)
+          && is.peek() == std::ios::traits_type::eof();
+  }
+
+} // namespace
+
+
+/// NNUE::init() reads the UCI options and loads the network when it has changed.
+/// The classical evaluation is used when the network cannot be loaded.
+
+void NNUE::init() {
+
+  const PieceType Types[] = { PAWN, KNIGHT, BISHOP, ROOK, QUEEN };
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+      for (int i = 0; i < 5; ++i)
+      {
+          PieceSquareIndex[c][make_piece( c, Types[i])] = 1 + (2 * i    ) * SQUARE_NB;
+          PieceSquareIndex[c][make_piece(~c, Types[i])] = 1 + (2 * i + 1) * SQUARE_NB;
+      }
+
+  Enabled = false;
+
+  if (!Options["Use NNUE"])
+      return;
+
+  std::string fileName = Options["EvalFile"];
+
+  if (fileName != LoadedFile)
+  {
+      LoadedFile = load(fileName) ? fileName : "";
+
+      if (LoadedFile.empty())
+          sync_cout << "info string Unable to load network " << fileName
+                    << ", using the classical evaluation" << sync_endl;
+      else
+          sync_cout << "info string Loaded network " << fileName << sync_endl;
+  }
+
+  Enabled = !LoadedFile.empty();
+}
+
+
+/// NNUE::refresh_accumulator() computes the accumulator of a root position from
+/// scratch. It is called for each thread before the search starts, so that the
+/// threads never build it lazily from the game history they share.
+
+void NNUE::refresh_accumulator(const Position& pos) {
+
+  StateInfo* st = pos.state();
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+      refresh(pos, c, st->accumulator.accumulation[c]);
+
+  st->accumulator.computed = true;
+}
+
+
+/// NNUE::evaluate() returns the evaluation of the network from the point of
+/// view of the side to move.
+
+Value NNUE::evaluate(const Position& pos) {
+
+  assert(Enabled);
+
+  update_accumulator(pos);
+
+  const Accumulator& acc = pos.state()->accumulator;
+  Color perspectives[] = { pos.side_to_move(), ~pos.side_to_move() };
+
+  alignas(32) uint8_t transformed[2 * HalfDimensions];
+  alignas(32) int32_t l1Out[L1], l2Out[L2], out[1];
+  alignas(32) uint8_t l1In[L1], l2In[L2];
+
+  for (int p = 0; p < 2; ++p)
+      for (int j = 0; j < HalfDimensions; ++j)
+          transformed[p * HalfDimensions + j] =
+              uint8_t(std::max(0, std::min(127, int(acc.accumulation[perspectives[p]][j]))));
+
+  affine(transformed, l1Out, &L1Weights[0], &L1Biases[0], 2 * HalfDimensions, L1);
+  clipped_relu(l1Out, l1In, L1);
+  affine(l1In, l2Out, &L2Weights[0], &L2Biases[0], L1, L2);
+  clipped_relu(l2Out, l2In, L2);
+  affine(l2In, out, &OutWeights[0], &OutBiases[0], L2, 1);
+
+  Value v = Value(out[0] / OutputScale);
+
+  return std::max(-VALUE_MATE_IN_MAX_PLY + 1, std::min(VALUE_MATE_IN_MAX_PLY - 1, v));
+}
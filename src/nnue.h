@@ -0,0 +1,67 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2017 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NNUE_H_INCLUDED
+#define NNUE_H_INCLUDED
+
+#include <string>
+
+#include "types.h"
+
+class Position;
+
+namespace NNUE {
+
+/// The network is the HalfKP 256x2-32-32 architecture: the position is encoded
+/// as the pieces seen from each king, which the feature transformer turns into
+/// two halves of 256 neurons. These are followed by two hidden layers of 32
+/// neurons and a single output. The first layer is by far the largest, but a
+/// move changes only a few of its inputs, so it is updated incrementally.
+
+const int HalfDimensions = 256;
+
+/// NNUE::Accumulator holds the output of the feature transformer from the point
+/// of view of each color. It is stored in the StateInfo and computed when the
+/// position is first evaluated, from the previous one when possible.
+
+struct Accumulator {
+  int16_t accumulation[COLOR_NB][HalfDimensions];
+  bool computed;
+};
+
+/// NNUE::DirtyPiece records the pieces changed by the last move, set by
+/// Position::do_move(). A square is SQ_NONE when the piece is added or removed.
+
+struct DirtyPiece {
+  int dirtyNum;
+  Piece piece[3];
+  Square from[3];
+  Square to[3];
+};
+
+extern bool Enabled;
+
+void init();
+void refresh_accumulator(const Position& pos);
+Value evaluate(const Position& pos);
+
+} // namespace NNUE
+
+#endif // #ifndef NNUE_H_INCLUDED
@@ -221,10 +221,24 @@ void init() {
 Entry* probe(const Position& pos) {
 
   Key key = pos.pawn_key();
-  Entry* e = pos.this_thread()->pawnsTable[key];
+  Table& table = pos.this_thread()->pawnsTable;
+  Entry* e = table[key];
 
-  if (e->key == key)
-      return e;
+  ++table.probes;
+
+  for (int i = 0; i < Table::ClusterSize; ++i)
+      if (e[i].key == key)
+      {
+          // Move the entry to the front of its bucket
+          if (i)
+              std::rotate(e, e + i, e + i + 1);
+
+          ++table.hits;
+          return e;
+      }
+
+  // Replace the least recently used entry, at the back, and move it to the front
+  std::rotate(e, e + Table::ClusterSize - 1, e + Table::ClusterSize);
 
   e->key = key;
   e->score = evaluate<WHITE>(pos, e) - evaluate<BLACK>(pos, e);
@@ -234,6 +248,38 @@ Entry* probe(const Position& pos) {
 }
 
 
+/// Table::resize() sets the size of the table in megabytes, rounded down to a
+/// power of two number of buckets, and clears it.
+
+void Table::resize(size_t mbSize) {
+
+  size_t bucketCount = size_t(1) << msb((mbSize * 1024 * 1024) / (ClusterSize * sizeof(Entry)));
+
+  table.assign(bucketCount * ClusterSize, Entry());
+  mask = bucketCount - 1;
+  probes = hits = kingSafetyCalls = kingSafetyUpdates = 0;
+}
+
+
+/// Entry::king_safety() returns the king safety bonus, computed again only
+/// when the king square or the castling rights have changed.
+
+template<Color Us>
+Score Entry::king_safety(const Position& pos, Square ksq) {
+
+  Table& table = pos.this_thread()->pawnsTable;
+
+  ++table.kingSafetyCalls;
+
+  if (kingSquares[Us] == ksq && castlingRights[Us] == pos.can_castle(Us))
+      return kingSafety[Us];
+
+  ++table.kingSafetyUpdates;
+
+  return kingSafety[Us] = do_king_safety<Us>(pos, ksq);
+}
+
+
 /// Entry::shelter_storm() calculates shelter and storm penalties for the file
 /// the king is on, as well as the two closest files.
 
@@ -272,7 +318,8 @@ Value Entry::shelter_storm(const Position& pos, Square ksq) {
 
 
 /// Entry::do_king_safety() calculates a bonus for king safety. It is called only
-/// when king square changes, which is about 20% of total king_safety() calls.
+/// when king square or castling rights change, which is about 30% of total
+/// king_safety() calls.
 
 template<Color Us>
 Score Entry::do_king_safety(const Position& pos, Square ksq) {
@@ -298,7 +345,7 @@ Score Entry::do_king_safety(const Position& pos, Square ksq) {
 }
 
 // Explicit template instantiation
-template Score Entry::do_king_safety<WHITE>(const Position& pos, Square ksq);
-template Score Entry::do_king_safety<BLACK>(const Position& pos, Square ksq);
+template Score Entry::king_safety<WHITE>(const Position& pos, Square ksq);
+template Score Entry::king_safety<BLACK>(const Position& pos, Square ksq);
 
 } // namespace Pawns
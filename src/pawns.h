@@ -21,6 +21,8 @@
 #ifndef PAWNS_H_INCLUDED
 #define PAWNS_H_INCLUDED
 
+#include <vector>
+
 #include "misc.h"
 #include "position.h"
 #include "types.h"
@@ -53,10 +55,7 @@ struct Entry {
   }
 
   template<Color Us>
-  Score king_safety(const Position& pos, Square ksq) {
-    return  kingSquares[Us] == ksq && castlingRights[Us] == pos.can_castle(Us)
-          ? kingSafety[Us] : (kingSafety[Us] = do_king_safety<Us>(pos, ksq));
-  }
+  Score king_safety(const Position& pos, Square ksq);
 
   template<Color Us>
   Score do_king_safety(const Position& pos, Square ksq);
@@ -78,7 +77,27 @@ struct Entry {
   int openFiles;
 };
 
-typedef HashTable<Entry, 16384> Table;
+/// Pawns::Table is the pawn hash table of a thread, sized by the "Pawn Hash"
+/// UCI option. Each key maps to a bucket of ClusterSize entries, kept in most
+/// recently used order, so that a miss replaces the least recently used one.
+/// The table also counts its hits and the king safety recomputations, to help
+/// choosing its size.
+
+class Table {
+
+public:
+  static const int ClusterSize = 4;
+
+  Entry* operator[](Key key) { return &table[((uint32_t)key & mask) * ClusterSize]; }
+  void resize(size_t mbSize);
+
+  uint64_t probes, hits;
+  uint64_t kingSafetyCalls, kingSafetyUpdates;
+
+private:
+  std::vector<Entry> table;
+  size_t mask;
+};
 
 void init();
 Entry* probe(const Position& pos);
@@ -26,6 +26,7 @@
 #include <sstream>
 
 #include "bitboard.h"
+#include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
 #include "position.h"
@@ -50,6 +51,19 @@ namespace Zobrist {
 
 namespace {
 
+// Marcel van Kervinck's cuckoo algorithm for fast detection of "upcoming
+// repetition" situations: the Zobrist differences of all the reversible moves
+// of non-pawn pieces are stored in a cuckoo hash, so that a key difference
+// between the current position and an earlier one can be matched to a move.
+
+// First and second hash functions for indexing the cuckoo tables
+inline int H1(Key h) { return h & 0x1fff; }
+inline int H2(Key h) { return (h >> 16) & 0x1fff; }
+
+// Cuckoo tables with Zobrist hashes of valid reversible moves, and the moves themselves
+Key cuckoo[8192];
+Move cuckooMove[8192];
+
 const string PieceToChar(" PNBRQK  pnbrqk");
 
 const Piece Pieces[] = { W_PAWN, W_KNIGHT, W_BISHOP, W_ROOK, W_QUEEN, W_KING,
@@ -152,6 +166,32 @@ void Position::init() {
 
   Zobrist::side = rng.rand<Key>();
   Zobrist::noPawns = rng.rand<Key>();
+
+  // Prepare the cuckoo tables
+  int count = 0;
+
+  for (Piece pc : Pieces)
+      for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
+          for (Square s2 = Square(s1 + 1); s2 <= SQ_H8; ++s2)
+              if (PseudoAttacks[type_of(pc)][s1] & s2)
+              {
+                  Move move = make_move(s1, s2);
+                  Key key = Zobrist::psq[pc][s1] ^ Zobrist::psq[pc][s2] ^ Zobrist::side;
+                  int i = H1(key);
+
+                  while (true)
+                  {
+                      std::swap(cuckoo[i], key);
+                      std::swap(cuckooMove[i], move);
+                      if (move == MOVE_NONE) // Arrived at empty slot?
+                          break;
+                      i = (i == H1(key)) ? H2(key) : H1(key); // Push victim to alternative slot
+                  }
+                  count++;
+              }
+
+  assert(count == 3668);
+  (void)count;
 }
 
 
@@ -278,8 +318,14 @@ Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Th
 
   chess960 = isChess960;
   thisThread = th;
+  if (HasAttackMaps)
+      update_attacks(pieces());
+
   set_state(st);
 
+  startPly = gamePly;
+  ++keyCount[st->key & (KeyCountSize - 1)];
+
   assert(pos_is_ok());
 
   return *this;
@@ -313,12 +359,25 @@ void Position::set_castling_right(Color c, Square rfrom) {
 }
 
 
-/// Position::set_check_info() sets king attacks to detect if a move gives check
+/// Position::set_check_info() sets pinned pieces and king attacks to detect if
+/// a move gives check. When making a move only the pins are computed, because
+/// they are needed by the evaluation and the move generators almost always,
+/// while the check squares are computed by check_squares() on first use: nodes
+/// that are cut off or stand pat in qsearch never need them.
 
 void Position::set_check_info(StateInfo* si) const {
 
+  set_pin_info(si);
+  set_check_squares(si);
+}
+
+void Position::set_pin_info(StateInfo* si) const {
+
   si->blockersForKing[WHITE] = slider_blockers(pieces(BLACK), square<KING>(WHITE), si->pinnersForKing[WHITE]);
   si->blockersForKing[BLACK] = slider_blockers(pieces(WHITE), square<KING>(BLACK), si->pinnersForKing[BLACK]);
+}
+
+void Position::set_check_squares(StateInfo* si) const {
 
   Square ksq = square<KING>(~sideToMove);
 
@@ -328,6 +387,8 @@ void Position::set_check_info(StateInfo* si) const {
   si->checkSquares[ROOK]   = attacks_from<ROOK>(ksq);
   si->checkSquares[QUEEN]  = si->checkSquares[BISHOP] | si->checkSquares[ROOK];
   si->checkSquares[KING]   = 0;
+
+  si->checkSquaresSet = true;
 }
 
 
@@ -342,6 +403,7 @@ void Position::set_state(StateInfo* si) const {
   si->pawnKey = Zobrist::noPawns;
   si->nonPawnMaterial[WHITE] = si->nonPawnMaterial[BLACK] = VALUE_ZERO;
   si->psq = SCORE_ZERO;
+  si->evalTerms = Eval::compute_terms(*this);
   si->checkersBB = attackers_to(square<KING>(sideToMove)) & pieces(~sideToMove);
 
   set_check_info(si);
@@ -380,16 +442,16 @@ void Position::set_state(StateInfo* si) const {
 
 
 /// Position::set() is an overload to initialize the position object with
-/// the given endgame code string like "KBPKN". It is mainly a helper to
-/// get the material key out of an endgame code.
+/// the given endgame code string like "KBPKN" or "KBPvKN". It is mainly a
+/// helper to get the material key out of an endgame code.
 
 Position& Position::set(const string& code, Color c, StateInfo* si) {
 
-  assert(code.length() > 0 && code.length() < 8);
+  assert(code.length() > 0 && code.length() < 9);
   assert(code[0] == 'K');
 
-  string sides[] = { code.substr(code.find('K', 1)),      // Weak
-                     code.substr(0, code.find('K', 1)) }; // Strong
+  string sides[] = { code.substr(code.find('K', 1)),                                // Weak
+                     code.substr(0, std::min(code.find('v'), code.find('K', 1))) }; // Strong
 
   std::transform(sides[c].begin(), sides[c].end(), sides[c].begin(), tolower);
 
@@ -623,7 +685,7 @@ bool Position::gives_check(Move m) const {
   Square to = to_sq(m);
 
   // Is there a direct check?
-  if (st->checkSquares[type_of(piece_on(from))] & to)
+  if (check_squares(type_of(piece_on(from))) & to)
       return true;
 
   // Is there a discovered check?
@@ -699,11 +761,20 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   Square to = to_sq(m);
   Piece pc = piece_on(from);
   Piece captured = type_of(m) == ENPASSANT ? make_piece(them, PAWN) : piece_on(to);
+  Bitboard changed = SquareBB[from] | to;
 
   assert(color_of(pc) == us);
   assert(captured == NO_PIECE || color_of(captured) == (type_of(m) != CASTLING ? them : us));
   assert(type_of(captured) != KING);
 
+  // Record the changed pieces, so that the NNUE accumulator can be updated
+  NNUE::DirtyPiece& dp = st->dirtyPiece;
+  dp.dirtyNum = 1;
+  dp.piece[0] = pc;
+  dp.from[0] = from;
+  dp.to[0] = to;
+  st->accumulator.computed = false;
+
   if (type_of(m) == CASTLING)
   {
       assert(pc == make_piece(us, KING));
@@ -711,6 +782,13 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
       Square rfrom, rto;
       do_castling<true>(us, from, to, rfrom, rto);
+      changed |= SquareBB[to] | rfrom | rto;
+
+      dp.dirtyNum = 2;
+      dp.to[0] = to;
+      dp.piece[1] = captured;
+      dp.from[1] = rfrom;
+      dp.to[1] = rto;
 
       st->psq += PSQT::psq[captured][rto] - PSQT::psq[captured][rfrom];
       k ^= Zobrist::psq[captured][rfrom] ^ Zobrist::psq[captured][rto];
@@ -745,6 +823,12 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
       // Update board and piece lists
       remove_piece(captured, capsq);
+      changed |= capsq;
+
+      dp.dirtyNum = 2;
+      dp.piece[1] = captured;
+      dp.from[1] = capsq;
+      dp.to[1] = SQ_NONE;
 
       // Update material hash key and prefetch access to materialTable
       k ^= Zobrist::psq[captured][capsq];
@@ -753,6 +837,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
       // Update incremental scores
       st->psq -= PSQT::psq[captured][capsq];
+      st->evalTerms -= Eval::piece_terms(captured, capsq, square<KING>(them));
 
       // Reset rule 50 counter
       st->rule50 = 0;
@@ -801,14 +886,21 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
           remove_piece(pc, to);
           put_piece(promotion, to);
 
+          dp.to[0] = SQ_NONE;
+          dp.piece[dp.dirtyNum] = promotion;
+          dp.from[dp.dirtyNum] = SQ_NONE;
+          dp.to[dp.dirtyNum] = to;
+          dp.dirtyNum++;
+
           // Update hash keys
           k ^= Zobrist::psq[pc][to] ^ Zobrist::psq[promotion][to];
           st->pawnKey ^= Zobrist::psq[pc][to];
           st->materialKey ^=  Zobrist::psq[promotion][pieceCount[promotion]-1]
                             ^ Zobrist::psq[pc][pieceCount[pc]];
 
-          // Update incremental score
+          // Update incremental scores
           st->psq += PSQT::psq[promotion][to] - PSQT::psq[pc][to];
+          st->evalTerms += Eval::piece_terms(promotion, to, square<KING>(us));
 
           // Update material
           st->nonPawnMaterial[us] += PieceValue[MG][promotion];
@@ -822,22 +914,59 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       st->rule50 = 0;
   }
 
-  // Update incremental scores
+  // Update incremental scores. The terms of a piece depend on the square of
+  // its king, so they are all recomputed when the king moves.
   st->psq += PSQT::psq[pc][to] - PSQT::psq[pc][from];
 
+  if (type_of(pc) == KING)
+      st->evalTerms = Eval::compute_terms(*this);
+  else
+      st->evalTerms +=  Eval::piece_terms(pc, to, square<KING>(us))
+                      - Eval::piece_terms(pc, from, square<KING>(us));
+
   // Set capture piece
   st->capturedPiece = captured;
 
   // Update the key with the final value
   st->key = k;
 
+  // Calculate the distance to the previous occurrence of the position, negative
+  // if that one is a repetition as well. keyCount[] covers the positions on the
+  // path since set(), so the scan can be skipped when the key is not there and
+  // the 50-move window does not reach further back.
+  st->repetition = 0;
+  int end = std::min(st->rule50, st->pliesFromNull);
+
+  if (   end >= 4
+      && (keyCount[k & (KeyCountSize - 1)] || end > gamePly - startPly))
+  {
+      StateInfo* stp = st->previous->previous;
+
+      for (int i = 4; i <= end; i += 2)
+      {
+          stp = stp->previous->previous;
+          if (stp->key == k)
+          {
+              st->repetition = stp->repetition ? -i : i;
+              break;
+          }
+      }
+  }
+
+  ++keyCount[k & (KeyCountSize - 1)];
+
+  // Update the attacks of the moved pieces and of the sliders crossing them
+  if (HasAttackMaps)
+      update_attacks(changed);
+
   // Calculate checkers bitboard (if move gives check)
   st->checkersBB = givesCheck ? attackers_to(square<KING>(them)) & pieces(us) : 0;
 
   sideToMove = ~sideToMove;
 
-  // Update king attacks used for fast check detection
-  set_check_info(st);
+  // Update pinned pieces, king attacks for fast check detection are computed when needed
+  set_pin_info(st);
+  st->checkSquaresSet = false;
 
   assert(pos_is_ok());
 }
@@ -856,6 +985,7 @@ void Position::undo_move(Move m) {
   Square from = from_sq(m);
   Square to = to_sq(m);
   Piece pc = piece_on(to);
+  Bitboard changed = SquareBB[from] | to;
 
   assert(empty(from) || type_of(m) == CASTLING);
   assert(type_of(st->capturedPiece) != KING);
@@ -875,6 +1005,7 @@ void Position::undo_move(Move m) {
   {
       Square rfrom, rto;
       do_castling<false>(us, from, to, rfrom, rto);
+      changed |= SquareBB[to] | rfrom | rto;
   }
   else
   {
@@ -896,10 +1027,15 @@ void Position::undo_move(Move m) {
           }
 
           put_piece(st->capturedPiece, capsq); // Restore the captured piece
+          changed |= capsq;
       }
   }
 
+  if (HasAttackMaps)
+      update_attacks(changed);
+
   // Finally point our state pointer back to the previous state
+  --keyCount[st->key & (KeyCountSize - 1)];
   st = st->previous;
   --gamePly;
 
@@ -907,6 +1043,34 @@ void Position::undo_move(Move m) {
 }
 
 
+/// Position::update_attacks() refreshes the pieceAttacks[] table after the
+/// occupancy of the 'changed' squares has been modified. Besides the pieces on
+/// the changed squares, only the sliders whose attacks reach one of them can
+/// be affected. Entries of empty squares are left stale.
+
+void Position::update_attacks(Bitboard changed) {
+
+  Bitboard b = (pieces(BISHOP, ROOK) | pieces(QUEEN)) & ~changed;
+
+  while (b)
+  {
+      Square s = pop_lsb(&b);
+      if (pieceAttacks[s] & changed)
+          pieceAttacks[s] = attacks_from(type_of(piece_on(s)), s);
+  }
+
+  b = changed & pieces();
+
+  while (b)
+  {
+      Square s = pop_lsb(&b);
+      Piece pc = piece_on(s);
+      pieceAttacks[s] = type_of(pc) == PAWN ? attacks_from<PAWN>(s, color_of(pc))
+                                            : attacks_from(type_of(pc), s);
+  }
+}
+
+
 /// Position::do_castling() is a helper used to do/undo a castling move. This
 /// is a bit tricky in Chess960 where from/to squares can overlap.
 template<bool Do>
@@ -934,7 +1098,7 @@ void Position::do_null_move(StateInfo& newSt) {
   assert(!checkers());
   assert(&newSt != st);
 
-  std::memcpy(&newSt, st, sizeof(StateInfo));
+  std::memcpy(&newSt, st, offsetof(StateInfo, checkSquares));
   newSt.previous = st;
   st = &newSt;
 
@@ -949,10 +1113,16 @@ void Position::do_null_move(StateInfo& newSt) {
 
   ++st->rule50;
   st->pliesFromNull = 0;
+  st->repetition = 0;
+  ++keyCount[st->key & (KeyCountSize - 1)];
 
   sideToMove = ~sideToMove;
 
-  set_check_info(st);
+  // Pins are unchanged and have been copied, check squares depend on side to move
+  st->checkSquaresSet = false;
+
+  st->dirtyPiece.dirtyNum = 0;
+  st->accumulator.computed = false;
 
   assert(pos_is_ok());
 }
@@ -961,6 +1131,7 @@ void Position::undo_null_move() {
 
   assert(!checkers());
 
+  --keyCount[st->key & (KeyCountSize - 1)];
   st = st->previous;
   sideToMove = ~sideToMove;
 }
@@ -1065,38 +1236,74 @@ bool Position::see_ge(Move m, Value threshold) const {
 }
 
 
-/// Position::is_draw() tests whether the position is drawn by 50-move rule
-/// or by repetition. It does not detect stalemates.
+/// Position::has_game_cycle() tests if the position has a move which draws by
+/// repetition, or an earlier position has a move that directly reaches the
+/// current position.
 
-bool Position::is_draw(int ply) const {
+bool Position::has_game_cycle(int ply) const {
 
-  if (st->rule50 > 99 && (!checkers() || MoveList<LEGAL>(*this).size()))
-      return true;
+  int j;
 
   int end = std::min(st->rule50, st->pliesFromNull);
 
-  if (end < 4)
-    return false;
+  if (end < 3)
+      return false;
 
-  StateInfo* stp = st->previous->previous;
-  int cnt = 0;
+  Key originalKey = st->key;
+  StateInfo* stp = st->previous;
 
-  for (int i = 4; i <= end; i += 2)
+  for (int i = 3; i <= end; i += 2)
   {
       stp = stp->previous->previous;
 
-      // At root position ply is 1, so return a draw score if a position
-      // repeats once earlier but strictly after the root, or repeats twice
-      // before or at the root.
-      if (   stp->key == st->key
-          && ++cnt + (ply - 1 > i) == 2)
-          return true;
+      Key moveKey = originalKey ^ stp->key;
+      if (   (j = H1(moveKey), cuckoo[j] == moveKey)
+          || (j = H2(moveKey), cuckoo[j] == moveKey))
+      {
+          Move move = cuckooMove[j];
+          Square s1 = from_sq(move);
+          Square s2 = to_sq(move);
+
+          if (!(between_bb(s1, s2) & pieces()))
+          {
+              // At root position ply is 1, so the cycle is a draw if it
+              // closes strictly after the root.
+              if (ply - 1 > i)
+                  return true;
+
+              // For nodes before or at the root, check that the move is a
+              // repetition rather than a move to the current position.
+              // In the cuckoo table, both moves Rc1c5 and Rc5c1 are stored in
+              // the same location, so we have to select which square to check.
+              if (color_of(piece_on(empty(s1) ? s2 : s1)) != side_to_move())
+                  continue;
+
+              // For repetitions before or at the root, require one more
+              if (stp->repetition)
+                  return true;
+          }
+      }
   }
 
   return false;
 }
 
 
+/// Position::is_draw() tests whether the position is drawn by 50-move rule
+/// or by repetition. It does not detect stalemates.
+
+bool Position::is_draw(int ply) const {
+
+  if (st->rule50 > 99 && (!checkers() || MoveList<LEGAL>(*this).size()))
+      return true;
+
+  // At root position ply is 1, so return a draw score if a position
+  // repeats once earlier but strictly after the root, or repeats twice
+  // before or at the root.
+  return st->repetition && st->repetition < ply - 1;
+}
+
+
 /// Position::flip() flips position with the white and black sides reversed. This
 /// is only useful for debugging e.g. for finding evaluation symmetry bugs.
 
@@ -1171,6 +1378,18 @@ bool Position::pos_is_ok() const {
           if (p1 != p2 && (pieces(p1) & pieces(p2)))
               assert(0 && "pos_is_ok: Bitboards");
 
+  for (Bitboard b = HasAttackMaps ? pieces() : 0; b; )
+  {
+      Square s = pop_lsb(&b);
+      Piece pc = piece_on(s);
+      if (pieceAttacks[s] != (type_of(pc) == PAWN ? attacks_from<PAWN>(s, color_of(pc))
+                                                  : attacks_from(type_of(pc), s)))
+          assert(0 && "pos_is_ok: Attacks");
+  }
+
+  if (!st->checkSquaresSet)
+      set_check_squares(st);
+
   StateInfo si = *st;
   set_state(&si);
   if (std::memcmp(&si, st, sizeof(StateInfo)))
@@ -22,11 +22,12 @@
 #define POSITION_H_INCLUDED
 
 #include <cassert>
-#include <deque>
 #include <memory> // For std::unique_ptr
 #include <string>
+#include <vector>
 
 #include "bitboard.h"
+#include "nnue.h"
 #include "types.h"
 
 
@@ -44,20 +45,33 @@ struct StateInfo {
   int    rule50;
   int    pliesFromNull;
   Score  psq;
+  Score  evalTerms;
   Square epSquare;
 
   // Not copied when making a move (will be recomputed anyhow)
   Key        key;
   Bitboard   checkersBB;
   Piece      capturedPiece;
+  int        repetition;
   StateInfo* previous;
   Bitboard   blockersForKing[COLOR_NB];
   Bitboard   pinnersForKing[COLOR_NB];
+
+  // Computed lazily, when first needed
   Bitboard   checkSquares[PIECE_TYPE_NB];
+  bool       checkSquaresSet;
+
+  // Used by the NNUE evaluation
+  NNUE::DirtyPiece  dirtyPiece;
+  NNUE::Accumulator accumulator;
 };
 
-// In a std::deque references to elements are unaffected upon resizing
-typedef std::unique_ptr<std::deque<StateInfo>> StateListPtr;
+// The game history is kept in a contiguous buffer whose capacity is reserved
+// up front: the elements are linked by 'previous' and must never be moved.
+typedef std::unique_ptr<std::vector<StateInfo>> StateListPtr;
+
+// Number of slots of the table counting the keys of the positions reached
+const int KeyCountSize = 4096;
 
 
 /// Position class stores information regarding the board representation as
@@ -112,6 +126,7 @@ public:
   Bitboard attacks_from(PieceType pt, Square s) const;
   template<PieceType> Bitboard attacks_from(Square s) const;
   template<PieceType> Bitboard attacks_from(Square s, Color c) const;
+  Bitboard piece_attacks(Square s) const;
   Bitboard slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
 
   // Properties of moves
@@ -149,9 +164,12 @@ public:
   int game_ply() const;
   bool is_chess960() const;
   Thread* this_thread() const;
+  StateInfo* state() const;
   bool is_draw(int ply) const;
+  bool has_game_cycle(int ply) const;
   int rule50_count() const;
   Score psq_score() const;
+  Score eval_terms() const;
   Value non_pawn_material(Color c) const;
   Value non_pawn_material() const;
 
@@ -164,11 +182,14 @@ private:
   void set_castling_right(Color c, Square rfrom);
   void set_state(StateInfo* si) const;
   void set_check_info(StateInfo* si) const;
+  void set_pin_info(StateInfo* si) const;
+  void set_check_squares(StateInfo* si) const;
 
   // Other helpers
   void put_piece(Piece pc, Square s);
   void remove_piece(Piece pc, Square s);
   void move_piece(Piece pc, Square from, Square to);
+  void update_attacks(Bitboard changed);
   template<bool Do>
   void do_castling(Color us, Square from, Square& to, Square& rfrom, Square& rto);
 
@@ -179,10 +200,13 @@ private:
   int pieceCount[PIECE_NB];
   Square pieceList[PIECE_NB][16];
   int index[SQUARE_NB];
+  Bitboard pieceAttacks[SQUARE_NB];
   int castlingRightsMask[SQUARE_NB];
   Square castlingRookSquare[CASTLING_RIGHT_NB];
+  uint16_t keyCount[KeyCountSize];
   Bitboard castlingPath[CASTLING_RIGHT_NB];
   int gamePly;
+  int startPly;
   Color sideToMove;
   Thread* thisThread;
   StateInfo* st;
@@ -285,6 +309,11 @@ inline Bitboard Position::attacks_from(PieceType pt, Square s) const {
   return attacks_bb(pt, s, byTypeBB[ALL_PIECES]);
 }
 
+inline Bitboard Position::piece_attacks(Square s) const {
+  assert(HasAttackMaps && !empty(s));
+  return pieceAttacks[s];
+}
+
 inline Bitboard Position::attackers_to(Square s) const {
   return attackers_to(s, byTypeBB[ALL_PIECES]);
 }
@@ -302,6 +331,9 @@ inline Bitboard Position::pinned_pieces(Color c) const {
 }
 
 inline Bitboard Position::check_squares(PieceType pt) const {
+  if (!st->checkSquaresSet)
+      set_check_squares(st);
+
   return st->checkSquares[pt];
 }
 
@@ -330,6 +362,10 @@ inline Score Position::psq_score() const {
   return st->psq;
 }
 
+inline Score Position::eval_terms() const {
+  return st->evalTerms;
+}
+
 inline Value Position::non_pawn_material(Color c) const {
   return st->nonPawnMaterial[c];
 }
@@ -375,6 +411,10 @@ inline Thread* Position::this_thread() const {
   return thisThread;
 }
 
+inline StateInfo* Position::state() const {
+  return st;
+}
+
 inline void Position::put_piece(Piece pc, Square s) {
 
   board[s] = pc;
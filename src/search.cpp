@@ -312,6 +312,11 @@ void MainThread::search() {
   if (bestThread != this)
       sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
 
+  // The UCI tbhits count includes the probes answered by the TB cache
+  if (Threads.tb_cache_hits())
+      sync_cout << "info string tbhits " << Threads.tb_hits()
+                << " cachehits " << Threads.tb_cache_hits() << sync_endl;
+
   sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
 
   if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
@@ -576,6 +581,17 @@ namespace {
             return ss->ply >= MAX_PLY && !inCheck ? evaluate(pos)
                                                   : DrawValue[pos.side_to_move()];
 
+        // Check if there exists a move which draws by repetition, or an
+        // alternative earlier move to this position.
+        if (   pos.rule50_count() >= 3
+            && alpha < DrawValue[pos.side_to_move()]
+            && pos.has_game_cycle(ss->ply))
+        {
+            alpha = DrawValue[pos.side_to_move()];
+            if (alpha >= beta)
+                return alpha;
+        }
+
         // Step 3. Mate distance pruning. Even if we mate at the next move our score
         // would be at best mate_in(ss->ply+1), but if alpha is already bigger because
         // a shorter mate was found upward in the tree then there is no need to search
@@ -773,18 +789,19 @@ namespace {
         MovePicker mp(pos, ttMove, rbeta - ss->staticEval);
 
         while ((move = mp.next_move()) != MOVE_NONE)
-            if (pos.legal(move))
-            {
-                ss->currentMove = move;
-                ss->history = &thisThread->counterMoveHistory[pos.moved_piece(move)][to_sq(move)];
-
-                assert(depth >= 5 * ONE_PLY);
-                pos.do_move(move, st);
-                value = -search<NonPV>(pos, ss+1, -rbeta, -rbeta+1, depth - 4 * ONE_PLY, !cutNode, false);
-                pos.undo_move(move);
-                if (value >= rbeta)
-                    return value;
-            }
+        {
+            assert(pos.legal(move));
+
+            ss->currentMove = move;
+            ss->history = &thisThread->counterMoveHistory[pos.moved_piece(move)][to_sq(move)];
+
+            assert(depth >= 5 * ONE_PLY);
+            pos.do_move(move, st);
+            value = -search<NonPV>(pos, ss+1, -rbeta, -rbeta+1, depth - 4 * ONE_PLY, !cutNode, false);
+            pos.undo_move(move);
+            if (value >= rbeta)
+                return value;
+        }
     }
 
     // Step 10. Internal iterative deepening (skipped when in check)
@@ -866,8 +883,7 @@ moves_loop: // When in check search starts from here
       // on all the other moves but the ttMove and if the result is lower than
       // ttValue minus a margin then we will extend the ttMove.
       if (    singularExtensionNode
-          &&  move == ttMove
-          &&  pos.legal(move))
+          &&  move == ttMove)
       {
           Value rBeta = std::max(ttValue - 2 * depth / ONE_PLY, -VALUE_MATE);
           Depth d = (depth / (2 * ONE_PLY)) * ONE_PLY;
@@ -931,12 +947,8 @@ moves_loop: // When in check search starts from here
       // Speculative prefetch as early as possible
       prefetch(TT.first_entry(pos.key_after(move)));
 
-      // Check for legality just before making the move
-      if (!rootNode && !pos.legal(move))
-      {
-          ss->moveCount = --moveCount;
-          continue;
-      }
+      // MovePicker returns only legal moves
+      assert(pos.legal(move));
 
       if (move == ttMove && captureOrPromotion)
           ttCapture = true;
@@ -1292,12 +1304,7 @@ moves_loop: // When in check search starts from here
       // Speculative prefetch as early as possible
       prefetch(TT.first_entry(pos.key_after(move)));
 
-      // Check for legality just before making the move
-      if (!pos.legal(move))
-      {
-          moveCount--;
-          continue;
-      }
+      assert(pos.legal(move));
 
       ss->currentMove = move;
 
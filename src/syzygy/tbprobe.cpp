@@ -23,16 +23,21 @@
 #include <cstring>   // For std::memset
 #include <deque>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <sstream>
+#include <thread>
 #include <type_traits>
 
 #include "../bitboard.h"
+#include "../misc.h"
 #include "../movegen.h"
 #include "../position.h"
 #include "../search.h"
-#include "../thread_win32.h"
+#include "../thread.h"
+#include "../uci.h"
 #include "../types.h"
 
 #include "tbprobe.h"
@@ -41,6 +46,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #else
 #define WIN32_LEAN_AND_MEAN
@@ -55,7 +61,7 @@ int Tablebases::MaxCardinality;
 namespace {
 
 // Each table has a set of flags: all of them refer to DTZ tables, the last one to WDL tables
-enum TBFlag { STM = 1, Mapped = 2, WinPlies = 4, LossPlies = 8, SingleValue = 128 };
+enum TBFlag { STM = 1, Mapped = 2, WinPlies = 4, LossPlies = 8, Wide = 16, SingleValue = 128 };
 
 inline WDLScore operator-(WDLScore d) { return WDLScore(-int(d)); }
 inline Square operator^=(Square& s, int i) { return s = Square(int(s) ^ i); }
@@ -102,7 +108,10 @@ struct LR {
 
 static_assert(sizeof(LR) == 3, "LR tree entry must be 3 bytes");
 
-const int TBPIECES = 6;
+const int TBPIECES = 7;
+
+// The Huffman codes up to LookupBits long are decoded with a single table lookup
+const int LookupBits = 10;
 
 struct PairsData {
     int flags;
@@ -120,6 +129,8 @@ struct PairsData {
     uint8_t* data;                 // Start of Huffman compressed data
     std::vector<uint64_t> base64;  // base64[l - min_sym_len] is the 64bit-padded lowest symbol of length l
     std::vector<uint8_t> symlen;   // Number of values (-1) represented by a given Huffman symbol: 1..256
+    std::vector<uint16_t> lookup;  // Symbol and length of the code starting with the next lookupBits bits
+    int lookupBits;                // Number of bits decoded by lookup[]: up to LookupBits
     Piece pieces[TBPIECES];        // Position pieces: the order of pieces defines the groups
     uint64_t groupIdx[TBPIECES+1]; // Start index used for the encoding of the group's pieces
     int groupLen[TBPIECES+1];      // Number of pieces in a given group: KRKN -> (3, 1)
@@ -127,10 +138,13 @@ struct PairsData {
 
 // Helper struct to avoid manually defining entry copy constructor as we
 // should because the default one is not compatible with std::atomic_bool.
+// The 'initializing' flag makes the entry initialization a per-entry once
+// operation: the first thread that sets it maps the file, the others wait
+// for 'ready'.
 struct Atomic {
     Atomic() = default;
-    Atomic(const Atomic& e) { ready = e.ready.load(); } // MSVC 2013 wants assignment within body
-    std::atomic_bool ready;
+    Atomic(const Atomic& e) { ready = e.ready.load(); initializing = e.initializing.load(); } // MSVC 2013 wants assignment within body
+    std::atomic_bool ready, initializing;
 };
 
 // We define types for the different parts of the WLDEntry and DTZEntry with
@@ -219,8 +233,8 @@ const Value WDL_to_value[] = {
 const std::string PieceToChar = " PNBRQK  pnbrqk";
 
 int Binomial[6][SQUARE_NB];    // [k][n] k elements from a set of n elements
-int LeadPawnIdx[5][SQUARE_NB]; // [leadPawnsCnt][SQUARE_NB]
-int LeadPawnsSize[5][4];       // [leadPawnsCnt][FILE_A..FILE_D]
+int LeadPawnIdx[6][SQUARE_NB]; // [leadPawnsCnt][SQUARE_NB]
+int LeadPawnsSize[6][4];       // [leadPawnsCnt][FILE_A..FILE_D]
 
 enum { BigEndian, LittleEndian };
 
@@ -255,13 +269,16 @@ class HashTable {
     typedef std::pair<WDLEntry*, DTZEntry*> EntryPair;
     typedef std::pair<Key, EntryPair> Entry;
 
-    static const int TBHASHBITS = 10;
-    static const int HSHMAX     = 5;
+    // With the 1511 tables up to 7 men, and two keys for each asymmetric one,
+    // the fullest bucket holds 5 entries: keep one more as a safety margin.
+    static const int TBHASHBITS = 12;
+    static const int HSHMAX     = 6;
 
     Entry hashTable[1 << TBHASHBITS][HSHMAX];
 
     std::deque<WDLEntry> wdlTable;
     std::deque<DTZEntry> dtzTable;
+    std::vector<std::string> codes; // Like "KRvK", same order as wdlTable
 
     void insert(Key key, WDLEntry* wdl, DTZEntry* dtz) {
         Entry* entry = hashTable[key >> (64 - TBHASHBITS)];
@@ -292,13 +309,99 @@ public:
       std::memset(hashTable, 0, sizeof(hashTable));
       wdlTable.clear();
       dtzTable.clear();
+      codes.clear();
   }
   size_t size() const { return wdlTable.size(); }
+  WDLEntry& wdl(size_t i) { return wdlTable[i]; }
+  DTZEntry& dtz(size_t i) { return dtzTable[i]; }
+  const std::string& code(size_t i) const { return codes[i]; }
   void insert(const std::vector<PieceType>& pieces);
 };
 
 HashTable EntryTable;
 
+// ProbeCache is a lockless cache of the results of probe_wdl() and probe_dtz(),
+// keyed by the position key, that is shared by all the threads. Each entry is
+// a single 64-bit word holding the upper 48 bits of the key and the result, so
+// a thread reads either the old or the new entry, never a mix of the two.
+class ProbeCache {
+
+    static const int SizeBits = 18;
+
+    std::atomic<uint64_t> table[1 << SizeBits];
+
+public:
+    bool probe(Key key, int* value, ProbeState* result) const {
+
+        uint64_t e = table[key & ((1 << SizeBits) - 1)].load(std::memory_order_relaxed);
+
+        if ((e ^ key) >> 16 || !(e & 0xC000))
+            return false;
+
+        *value  = int(e & 0x3FFF) - 0x2000;
+        *result = (e & 0xC000) == 0x8000 ? ZEROING_BEST_MOVE : OK;
+        return true;
+    }
+
+    void store(Key key, int value, ProbeState result) {
+
+        assert(result == OK || result == ZEROING_BEST_MOVE);
+        assert(value >= -0x2000 && value < 0x2000);
+
+        uint64_t e =  (key & ~uint64_t(0xFFFF))
+                    | (result == ZEROING_BEST_MOVE ? 0x8000 : 0x4000)
+                    | uint64_t(value + 0x2000);
+
+        table[key & ((1 << SizeBits) - 1)].store(e, std::memory_order_relaxed);
+    }
+
+    void clear() {
+        for (auto& e : table)
+            e.store(0, std::memory_order_relaxed);
+    }
+};
+
+ProbeCache WDLCache, DTZCache;
+
+// Add 't' ticks to the given stage of the statistics of the position's thread,
+// and to the latency histogram for probe_wdl()
+void record(const Position& pos, ProbeStage s, uint64_t t) {
+
+    if (Thread* th = pos.this_thread())
+    {
+        ProbeStats& ps = th->tbStats;
+        ps.calls[s]++, ps.ticks[s] += t;
+
+        if (s == PROBE_WDL)
+            ps.wdlLatency[std::min(int(msb(t | 1)), ProbeStats::LATENCY_BUCKET_NB - 1)]++;
+    }
+}
+
+// Page faults of the process, minor and major, when the tablebases were loaded
+uint64_t MinorFaults, MajorFaults;
+
+void page_faults(uint64_t& minor, uint64_t& major) {
+
+    minor = major = 0;
+
+#ifndef _WIN32
+    rusage ru;
+    if (!getrusage(RUSAGE_SELF, &ru))
+        minor = ru.ru_minflt, major = ru.ru_majflt;
+#endif
+}
+
+// StageTimer records the ticks spent in its scope in the given stage
+struct StageTimer {
+
+    StageTimer(const Position& p, ProbeStage s) : pos(p), stage(s), start(ticks()) {}
+   ~StageTimer() { record(pos, stage, ticks() - start); }
+
+    const Position& pos;
+    ProbeStage stage;
+    uint64_t start;
+};
+
 class TBFile : public std::ifstream {
 
     std::string fname;
@@ -312,6 +415,9 @@ public:
     // C:\tb\wdl345;C:\tb\wdl6;D:\tb\dtz345;D:\tb\dtz6
     static std::string Paths;
 
+    // The madvise() policy applied to the mapped files, MADV_NORMAL by default
+    static int Advice;
+
     TBFile(const std::string& f) {
 
 #ifndef _WIN32
@@ -350,6 +456,9 @@ public:
             std::cerr << "Could not mmap() " << fname << std::endl;
             exit(1);
         }
+
+        if (Advice != MADV_NORMAL)
+            madvise(*baseAddress, statbuf.st_size, Advice);
 #else
         HANDLE fd = CreateFile(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
@@ -399,6 +508,11 @@ public:
 };
 
 std::string TBFile::Paths;
+#ifndef _WIN32
+int TBFile::Advice = MADV_NORMAL;
+#else
+int TBFile::Advice = 0;
+#endif
 
 WDLEntry::WDLEntry(const std::string& code) {
 
@@ -407,7 +521,7 @@ WDLEntry::WDLEntry(const std::string& code) {
 
     memset(this, 0, sizeof(WDLEntry));
 
-    ready = false;
+    ready = initializing = false;
     key = pos.set(code, WHITE, &st).material_key();
     pieceCount = popcount(pos.pieces());
     hasPawns = pos.pieces(PAWN);
@@ -448,7 +562,7 @@ DTZEntry::DTZEntry(const WDLEntry& wdl) {
 
     memset(this, 0, sizeof(DTZEntry));
 
-    ready = false;
+    ready = initializing = false;
     key = wdl.key;
     key2 = wdl.key2;
     pieceCount = wdl.pieceCount;
@@ -489,6 +603,7 @@ void HashTable::insert(const std::vector<PieceType>& pieces) {
 
     MaxCardinality = std::max((int)pieces.size(), MaxCardinality);
 
+    codes.push_back(code);
     wdlTable.push_back(WDLEntry(code));
     dtzTable.push_back(DTZEntry(wdlTable.back()));
 
@@ -532,7 +647,7 @@ int decompress_pairs(PairsData* d, uint64_t idx) {
     //       I(k) = k * d->span + d->span / 2      (1)
 
     // First step is to get the 'k' of the I(k) nearest to our idx, using definition (1)
-    uint32_t k = idx / d->span;
+    uint32_t k = uint32_t(idx / d->span);
 
     // Then we read the corresponding SparseIndex[] entry
     uint32_t block = number<uint32_t, LittleEndian>(&d->sparseIndex[k].block);
@@ -557,7 +672,9 @@ int decompress_pairs(PairsData* d, uint64_t idx) {
         offset -= d->blockLength[block++] + 1;
 
     // Finally, we find the start address of our block of canonical Huffman symbols
-    uint32_t* ptr = (uint32_t*)(d->data + block * d->sizeofBlock);
+    // 7-men files are bigger than 4 GB, so the offset must be 64 bit also on
+    // 32 bit builds.
+    uint32_t* ptr = (uint32_t*)(d->data + uint64_t(block) * d->sizeofBlock);
 
     // Read the first 64 bits in our block, this is a (truncated) sequence of
     // unknown number of symbols of unknown length but we know the first one
@@ -567,21 +684,32 @@ int decompress_pairs(PairsData* d, uint64_t idx) {
     Sym sym;
 
     while (true) {
-        int len = 0; // This is the symbol length - d->min_sym_len
-
-        // Now get the symbol length. For any symbol s64 of length l right-padded
-        // to 64 bits we know that d->base64[l-1] >= s64 >= d->base64[l] so we
-        // can find the symbol length iterating through base64[].
-        while (buf64 < d->base64[len])
-            ++len;
-
-        // All the symbols of a given length are consecutive integers (numerical
-        // sequence property), so we can compute the offset of our symbol of
-        // length len, stored at the beginning of buf64.
-        sym = (buf64 - d->base64[len]) >> (64 - len - d->minSymLen);
-
-        // Now add the value of the lowest symbol of length len to get our symbol
-        sym += number<Sym, LittleEndian>(&d->lowestSym[len]);
+        // Most symbols are short enough to be decoded at once by lookup[]
+        int e = d->lookup[buf64 >> (64 - d->lookupBits)];
+        int len = e >> 12; // This is the real symbol length
+        sym = Sym(e & 0xFFF);
+
+        if (!len) {
+            // This is the symbol length - d->min_sym_len. We know that the code is
+            // longer than lookupBits, so we can start from there.
+            len = std::max(d->lookupBits + 1 - d->minSymLen, 0);
+
+            // Now get the symbol length. For any symbol s64 of length l right-padded
+            // to 64 bits we know that d->base64[l-1] >= s64 >= d->base64[l] so we
+            // can find the symbol length iterating through base64[].
+            while (buf64 < d->base64[len])
+                ++len;
+
+            // All the symbols of a given length are consecutive integers (numerical
+            // sequence property), so we can compute the offset of our symbol of
+            // length len, stored at the beginning of buf64.
+            sym = (buf64 - d->base64[len]) >> (64 - len - d->minSymLen);
+
+            // Now add the value of the lowest symbol of length len to get our symbol
+            sym += number<Sym, LittleEndian>(&d->lowestSym[len]);
+
+            len += d->minSymLen; // Get the real length
+        }
 
         // If our offset is within the number of values represented by symbol sym
         // we are done...
@@ -590,7 +718,6 @@ int decompress_pairs(PairsData* d, uint64_t idx) {
 
         // ...otherwise update the offset and continue to iterate
         offset -= d->symlen[sym] + 1;
-        len += d->minSymLen; // Get the real length
         buf64 <<= len;       // Consume the just processed symbol
         buf64Size -= len;
 
@@ -652,8 +779,13 @@ int map_score(DTZEntry* entry, File f, int value, WDLScore wdl) {
 
     uint16_t* idx = entry->hasPawns ? entry->pawnTable.file[f].map_idx
                                     : entry->pieceTable.map_idx;
-    if (flags & TBFlag::Mapped)
-        value = map[idx[WDLMap[wdl + 2]] + value];
+    // 7-men tables may store DTZ values above 255: they are then 16 bit wide
+    if (flags & TBFlag::Mapped) {
+        if (flags & TBFlag::Wide)
+            value = ((uint16_t*)map)[idx[WDLMap[wdl + 2]] + value];
+        else
+            value = map[idx[WDLMap[wdl + 2]] + value];
+    }
 
     // DTZ tables store distance to zero in number of moves or plies. We
     // want to return plies, so we have convert to plies when needed.
@@ -677,6 +809,7 @@ T do_probe_table(const Position& pos, Entry* entry, WDLScore wdl, ProbeState* re
 
     const bool IsWDL = std::is_same<Entry, WDLEntry>::value;
 
+    uint64_t start = ticks();
     Square squares[TBPIECES];
     Piece pieces[TBPIECES];
     uint64_t idx;
@@ -887,7 +1020,13 @@ encode_remaining:
     }
 
     // Now that we have the index, decompress the pair and get the score
-    return map_score(entry, tbFile, decompress_pairs(d, idx), wdl);
+    uint64_t t = ticks();
+    int value = decompress_pairs(d, idx);
+
+    record(pos, PROBE_INDEX, t - start);
+    record(pos, PROBE_DECOMPRESS, ticks() - t);
+
+    return map_score(entry, tbFile, value, wdl);
 }
 
 // Group together pieces that will be encoded together. The general rule is that
@@ -989,7 +1128,7 @@ uint8_t* set_sizes(PairsData* d, uint8_t* data) {
 
     // groupLen[] is a zero-terminated list of group lengths, the last groupIdx[]
     // element stores the biggest index that is the tb size.
-    uint64_t tbSize = d->groupIdx[std::find(d->groupLen, d->groupLen + 7, 0) - d->groupLen];
+    uint64_t tbSize = d->groupIdx[std::find(d->groupLen, d->groupLen + TBPIECES + 1, 0) - d->groupLen];
 
     d->sizeofBlock = 1ULL << *data++;
     d->span = 1ULL << *data++;
@@ -1024,6 +1163,31 @@ uint8_t* set_sizes(PairsData* d, uint8_t* data) {
         d->base64[i] <<= 64 - i - d->minSymLen; // Right-padding to 64 bits
 
     data += d->base64.size() * sizeof(Sym);
+
+    // Because of the prefix property, the first lookupBits bits of the buffer
+    // are enough to decode any code that is not longer. So for each of their
+    // values, lookup[] stores the symbol in the lower 12 bits and the length of
+    // its code in the upper 4 bits, or 0 when the code is longer and must be
+    // decoded the slow way.
+    d->lookupBits = std::min(d->maxSymLen, LookupBits);
+    d->lookup.resize(size_t(1) << d->lookupBits);
+
+    for (size_t b = 0; b < d->lookup.size(); ++b) {
+
+        uint64_t s64 = uint64_t(b) << (64 - d->lookupBits);
+        size_t len = 0;
+
+        while (len + 1 < d->base64.size() && s64 < d->base64[len])
+            ++len;
+
+        if (len + d->minSymLen > size_t(d->lookupBits))
+            continue;
+
+        Sym sym =  Sym((s64 - d->base64[len]) >> (64 - len - d->minSymLen))
+                 + number<Sym, LittleEndian>(&d->lowestSym[len]);
+
+        d->lookup[b] = uint16_t(sym | (len + d->minSymLen) << 12);
+    }
     d->symlen.resize(number<uint16_t, LittleEndian>(data)); data += sizeof(uint16_t);
     d->btree = (LR*)data;
 
@@ -1050,7 +1214,16 @@ uint8_t* set_dtz_map(DTZEntry&, T& p, uint8_t* data, File maxFile) {
     p.map = data;
 
     for (File f = FILE_A; f <= maxFile; ++f) {
-        if (item(p, 0, f).precomp->flags & TBFlag::Mapped)
+        int flags = item(p, 0, f).precomp->flags;
+
+        if ((flags & TBFlag::Mapped) && (flags & TBFlag::Wide)) {
+            data += (uintptr_t)data & 1; // Word alignment, the map may be mixed
+            for (int i = 0; i < 4; ++i) { // Same sequence with 16 bit values
+                item(p, 0, f).map_idx[i] = (uint16_t)((uint16_t*)data - (uint16_t*)p.map + 1);
+                data += 2 * number<uint16_t, LittleEndian>(data) + 2;
+            }
+        }
+        else if (flags & TBFlag::Mapped)
             for (int i = 0; i < 4; ++i) { // Sequence like 3,x,x,x,1,x,0,2,x,x
                 item(p, 0, f).map_idx[i] = (uint16_t)(data - p.map + 1);
                 data += *data + 1;
@@ -1123,7 +1296,7 @@ void do_init(Entry& e, T& p, uint8_t* data) {
         for (int i = 0; i < Sides; i++) {
             data = (uint8_t*)(((uintptr_t)data + 0x3F) & ~0x3F); // 64 byte alignment
             (d = item(p, i, f).precomp)->data = data;
-            data += d->blocksNum * d->sizeofBlock;
+            data += uint64_t(d->blocksNum) * d->sizeofBlock;
         }
 }
 
@@ -1132,17 +1305,20 @@ void* init(Entry& e, const Position& pos) {
 
     const bool IsWDL = std::is_same<Entry, WDLEntry>::value;
 
-    static Mutex mutex;
-
     // Avoid a thread reads 'ready' == true while another is still in do_init(),
     // this could happen due to compiler reordering.
     if (e.ready.load(std::memory_order_acquire))
         return e.baseAddress;
 
-    std::unique_lock<Mutex> lk(mutex);
+    // Only one thread initializes the entry, the others wait for it. Different
+    // entries are mapped concurrently.
+    if (e.initializing.exchange(true, std::memory_order_acquire))
+    {
+        while (!e.ready.load(std::memory_order_acquire))
+            std::this_thread::yield();
 
-    if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
         return e.baseAddress;
+    }
 
     // Pieces strings in decreasing order for each color, like ("KPP","KR")
     std::string fname, w, b;
@@ -1173,9 +1349,18 @@ T probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
 
     E* entry = EntryTable.get<E>(pos.material_key());
 
-    if (!entry || !init(*entry, pos))
+    if (!entry)
+        return *result = FAIL, T();
+
+    bool mapped = entry->ready.load(std::memory_order_acquire);
+    uint64_t t = mapped ? 0 : ticks();
+
+    if (!init(*entry, pos))
         return *result = FAIL, T();
 
+    if (!mapped)
+        record(pos, PROBE_MAP, ticks() - t);
+
     return do_probe_table(pos, entry, wdl, result);
 }
 
@@ -1254,11 +1439,320 @@ WDLScore search(Position& pos, ProbeState* result) {
     return *result = OK, value;
 }
 
+std::vector<std::thread> Mappers;
+std::atomic_bool StopMapping;
+
+// Map the WDL and DTZ files of all the tables found, in the background, using
+// the given number of threads. Each entry is still initialized only once, by
+// the first thread that needs it, either a mapper or a search thread, so that
+// searching can start while the mapping is in progress.
+void premap(size_t threadsNum) {
+
+    auto next = std::make_shared<std::atomic<size_t>>(0);
+
+    for (size_t t = 0; t < threadsNum; ++t)
+        Mappers.emplace_back([next]() {
+
+            size_t i;
+
+            while (!StopMapping && (i = (*next)++) < EntryTable.size())
+            {
+                StateInfo st;
+                Position pos;
+                pos.set(EntryTable.code(i), WHITE, &st);
+
+                init(EntryTable.wdl(i), pos);
+
+                if (TBFile(EntryTable.code(i) + ".rtbz").is_open())
+                    init(EntryTable.dtz(i), pos);
+            }
+        });
+}
+
 } // namespace
 
-void Tablebases::init(const std::string& paths) {
+/// Tablebases::stop_mapping() stops the background mapping started by init()
+/// and waits for the mapping threads to finish.
+
+void Tablebases::stop_mapping() {
+
+    StopMapping = true;
+
+    for (std::thread& th : Mappers)
+        th.join();
+
+    Mappers.clear();
+    StopMapping = false;
+}
+
+/// Tablebases::set_advice() sets the madvise() policy, "Normal", "Random" or
+/// "Willneed", of the tablebase files. It applies to the files already mapped
+/// and to the ones mapped later. Random disables the kernel readahead, that is
+/// mostly wasted on TB probes, Willneed starts reading the whole file.
+
+void Tablebases::set_advice(const std::string& policy) {
+
+#ifndef _WIN32
+    std::string p = policy;
+    std::transform(p.begin(), p.end(), p.begin(), ::tolower);
+
+    TBFile::Advice =  p == "random"   ? MADV_RANDOM
+                    : p == "willneed" ? MADV_WILLNEED : MADV_NORMAL;
+
+    for (size_t i = 0; i < EntryTable.size(); ++i)
+    {
+        TBEntry* entries[] = { &EntryTable.wdl(i), &EntryTable.dtz(i) };
+
+        for (TBEntry* e : entries)
+            if (e->ready.load(std::memory_order_acquire) && e->baseAddress)
+                madvise(e->baseAddress, e->mapping, TBFile::Advice);
+    }
+#else
+    (void)policy;
+#endif
+}
+
+/// Tablebases::warm() maps the WDL files of the given tables, like "KRvK", or
+/// of all the tables if none is given, and reads them into the page cache, so
+/// that the first probes don't wait for the disk. The files are read in parallel,
+/// one thread per core. Returns a summary of the work done.
+
+std::string Tablebases::warm(const std::vector<std::string>& codes) {
+
+    std::vector<std::string> todo = codes;
+    std::atomic<size_t> next(0), tables(0);
+    std::atomic<uint64_t> bytes(0);
+
+    if (todo.empty())
+        for (size_t i = 0; i < EntryTable.size(); ++i)
+            todo.push_back(EntryTable.code(i));
+
+    auto worker = [&]() {
+
+        size_t i;
+        while ((i = next++) < todo.size())
+        {
+            std::string code = todo[i];
+            code.erase(std::remove(code.begin(), code.end(), 'v'), code.end());
+
+            if (code.size() < 2 || code.size() > TBPIECES || code[0] != 'K' || code.find('K', 1) == std::string::npos)
+                continue;
+
+            StateInfo st;
+            Position pos;
+            pos.set(code, WHITE, &st);
+
+            WDLEntry* e = EntryTable.get<WDLEntry>(pos.material_key());
+            if (!e || !init(*e, pos))
+                continue;
+
+            tables++;
+#ifndef _WIN32
+            // Touch every page, so that it is read from disk if not yet cached
+            volatile uint8_t sink = 0;
+            for (uint64_t off = 0; off < e->mapping; off += 4096)
+                sink += ((uint8_t*)e->baseAddress)[off];
+
+            bytes += e->mapping;
+#endif
+        }
+    };
+
+    TimePoint elapsed = now();
+    std::vector<std::thread> threads;
+
+    for (size_t t = 1; t < std::max(1U, std::thread::hardware_concurrency()); ++t)
+        threads.emplace_back(worker);
+
+    worker();
+
+    for (std::thread& th : threads)
+        th.join();
+
+    elapsed = now() - elapsed;
+
+    std::stringstream ss;
+    ss << "info string Warmed " << tables << " of " << todo.size() << " tables, "
+       << bytes / (1024 * 1024) << " MB in " << elapsed << " ms";
+
+    return ss.str();
+}
+
+// random_fen() returns a FEN with the pieces of the given table, like "KRvK",
+// on random squares, pawns excluded from the first and last ranks.
+static std::string random_fen(PRNG& rng, const std::string& code) {
+
+    char board[SQUARE_NB];
+    std::fill(board, board + SQUARE_NB, ' ');
+    bool white = true;
+
+    for (char c : code)
+    {
+        if (c == 'v')
+        {
+            white = false;
+            continue;
+        }
+
+        Square s;
+        do s = Square(rng.rand<unsigned>() % SQUARE_NB);
+        while (board[s] != ' ' || (c == 'P' && (s < SQ_A2 || s > SQ_H7)));
+
+        board[s] = white ? c : char(tolower(c));
+    }
+
+    std::string fen;
+    for (Rank r = RANK_8; r >= RANK_1; --r)
+    {
+        int empty = 0;
+        for (File f = FILE_A; f <= FILE_H; ++f)
+            if (board[make_square(f, r)] == ' ')
+                ++empty;
+            else
+            {
+                if (empty)
+                    fen += char('0' + empty), empty = 0;
+                fen += board[make_square(f, r)];
+            }
+
+        if (empty)
+            fen += char('0' + empty);
+        fen += r > RANK_1 ? "/" : "";
+    }
+
+    return fen + (rng.rand<unsigned>() & 1 ? " w" : " b") + " - - 0 1";
+}
+
+/// Tablebases::bench() probes the WDL tables directly, bypassing the cache and
+/// the captures search, on a fixed set of random legal positions spread over all
+/// the tables found, and reports the probes per second. The checksum of the
+/// values found does not depend on the speed, so it checks that a change to the
+/// index computation or to the decompression does not change the results.
+
+std::string Tablebases::bench(int count) {
+
+    const uint64_t Probes = 1000000;
+
+    std::stringstream ss;
+
+    if (!EntryTable.size() || count <= 0)
+    {
+        ss << "info string No tablebases found";
+        return ss.str();
+    }
+
+    PRNG rng(1070372);
+    std::vector<Position> positions(count);
+    std::vector<StateInfo> states(count);
+
+    for (int i = 0; i < count; ++i)
+    {
+        const std::string& code = EntryTable.code(i % EntryTable.size());
+        Position& pos = positions[i];
+
+        // Retry until the side not to move is not in check. The probes are
+        // counted in the statistics of the main thread.
+        do pos.set(random_fen(rng, code), false, &states[i], Threads.main());
+        while (  pos.attackers_to(pos.square<KING>(~pos.side_to_move()))
+               & pos.pieces(pos.side_to_move()));
+    }
+
+    uint64_t probes = 0, failed = 0, checksum = 0;
+    TimePoint elapsed = now();
+
+    while (probes < Probes)
+        for (Position& pos : positions)
+        {
+            ProbeState result = OK;
+            WDLScore wdl = probe_table<WDLEntry>(pos, &result);
+
+            if (result == FAIL)
+                ++failed;
+            else
+                checksum = checksum * 5 + wdl + 2;
+            ++probes;
+        }
+
+    elapsed = now() - elapsed + 1;
+
+    ss << "info string Probes " << probes << " on " << count << " positions"
+       << ", failed " << failed << ", checksum " << checksum << ", " << elapsed << " ms, "
+       << 1000 * probes / elapsed << " probes/second";
+
+    return ss.str();
+}
+
+// latency_histogram() formats the probe_wdl() latencies for Tablebases::stats()
+static std::string latency_histogram(const uint64_t* hist) {
+
+    uint64_t total = 0;
+    for (int i = 0; i < ProbeStats::LATENCY_BUCKET_NB; ++i)
+        total += hist[i];
+
+    std::stringstream ss;
+    ss << "WDL probes: " << total;
+
+    if (!total)
+        return ss.str();
+
+    ss << "\n" << std::setw(19) << "Latency (ticks)" << std::setw(12) << "Probes" << std::setw(8) << "%";
+
+    for (int i = 0; i < ProbeStats::LATENCY_BUCKET_NB; ++i)
+        if (hist[i])
+            ss << "\n" << std::setw(8) << (1ULL << i) << " - " << std::setw(8) << (2ULL << i) - 1
+               << std::setw(12) << hist[i]
+               << std::setw(8) << std::fixed << std::setprecision(2) << 100.0 * hist[i] / total;
+
+    return ss.str();
+}
+
+/// Tablebases::stats() returns the histogram of the probe_wdl() latencies since
+/// the tablebases were loaded, including the probes answered by the cache, the
+/// calls and ticks of each probing stage summed over the threads, the probes of
+/// each thread and the page faults of the process in the same period. Major faults
+/// are the pages read from disk, so mostly the tablebase I/O.
+
+std::string Tablebases::stats() {
+
+    const char* StageNames[] = { "probe_wdl", "probe_dtz", "root_probe",
+                                 "  map", "  index", "  decompress" };
+    ProbeStats total = ProbeStats();
+    std::stringstream ss;
+
+    for (Thread* th : Threads)
+        total += th->tbStats;
+
+    ss << std::left << std::setw(14) << "Stage" << std::right << std::setw(14) << "Calls"
+       << std::setw(14) << "Ticks/call" << std::setw(16) << "Ticks";
+
+    for (int i = 0; i < PROBE_STAGE_NB; ++i)
+        ss << "\n" << std::left << std::setw(14) << StageNames[i] << std::right
+           << std::setw(14) << total.calls[i]
+           << std::setw(14) << (total.calls[i] ? total.ticks[i] / total.calls[i] : 0)
+           << std::setw(16) << total.ticks[i];
+
+    for (Thread* th : Threads)
+        ss << "\nThread " << th->idx << ": " << th->tbStats.calls[PROBE_WDL] << " WDL, "
+           << th->tbStats.calls[PROBE_DTZ] << " DTZ probes";
+
+    uint64_t minor, major;
+    page_faults(minor, major);
+    ss << "\nPage faults: " << major - MajorFaults << " major, "
+       << minor - MinorFaults << " minor\n";
+
+    return ss.str() + latency_histogram(total.wdlLatency);
+}
+
+void Tablebases::init(const std::string& paths, bool premapTables) {
 
+    stop_mapping();
     EntryTable.clear();
+    WDLCache.clear();
+    DTZCache.clear();
+
+    for (Thread* th : Threads)
+        th->tbStats = ProbeStats();
+    page_faults(MinorFaults, MajorFaults);
     MaxCardinality = 0;
     TBFile::Paths = paths;
 
@@ -1327,9 +1821,9 @@ void Tablebases::init(const std::string& paths) {
     // among pawns with same file, the one with lowest rank.
     int availableSquares = 47; // Available squares when lead pawn is in a2
 
-    // Init the tables for the encoding of leading pawns group: with 6-men TB we
-    // can have up to 4 leading pawns (KPPPPK).
-    for (int leadPawnsCnt = 1; leadPawnsCnt <= 4; ++leadPawnsCnt)
+    // Init the tables for the encoding of leading pawns group: with 7-men TB we
+    // can have up to 5 leading pawns (KPPPPPK).
+    for (int leadPawnsCnt = 1; leadPawnsCnt <= 5; ++leadPawnsCnt)
         for (File f = FILE_A; f <= FILE_D; ++f)
         {
             // Restart the index at every file because TB table is splitted
@@ -1372,11 +1866,22 @@ void Tablebases::init(const std::string& paths) {
             for (PieceType p3 = PAWN; p3 <= p2; ++p3) {
                 EntryTable.insert({KING, p1, p2, p3, KING});
 
-                for (PieceType p4 = PAWN; p4 <= p3; ++p4)
+                for (PieceType p4 = PAWN; p4 <= p3; ++p4) {
                     EntryTable.insert({KING, p1, p2, p3, p4, KING});
 
-                for (PieceType p4 = PAWN; p4 < KING; ++p4)
+                    for (PieceType p5 = PAWN; p5 <= p4; ++p5)
+                        EntryTable.insert({KING, p1, p2, p3, p4, p5, KING});
+
+                    for (PieceType p5 = PAWN; p5 < KING; ++p5)
+                        EntryTable.insert({KING, p1, p2, p3, p4, KING, p5});
+                }
+
+                for (PieceType p4 = PAWN; p4 < KING; ++p4) {
                     EntryTable.insert({KING, p1, p2, p3, KING, p4});
+
+                    for (PieceType p5 = PAWN; p5 <= p4; ++p5)
+                        EntryTable.insert({KING, p1, p2, p3, KING, p4, p5});
+                }
             }
 
             for (PieceType p3 = PAWN; p3 <= p1; ++p3)
@@ -1386,6 +1891,9 @@ void Tablebases::init(const std::string& paths) {
     }
 
     sync_cout << "info string Found " << EntryTable.size() << " tablebases" << sync_endl;
+
+    if (premapTables && EntryTable.size())
+        premap(std::max(1U, std::thread::hardware_concurrency()));
 }
 
 // Probe the WDL table for a particular position.
@@ -1396,38 +1904,35 @@ void Tablebases::init(const std::string& paths) {
 //  0 : draw
 //  1 : win, but draw under 50-move rule
 //  2 : win
+//
+// Results are cached in WDLCache, so that a position probed again, possibly by
+// another thread, does not go through the captures search and the decompression.
 WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 
+    StageTimer timer(pos, PROBE_WDL);
+    int v;
+
+    if (WDLCache.probe(pos.key(), &v, result))
+    {
+        if (pos.this_thread())
+            pos.this_thread()->tbCacheHits.fetch_add(1, std::memory_order_relaxed);
+
+        return WDLScore(v);
+    }
+
     *result = OK;
-    return search(pos, result);
+    WDLScore wdl = search(pos, result);
+
+    if (*result != FAIL)
+        WDLCache.store(pos.key(), wdl, *result);
+
+    return wdl;
 }
 
-// Probe the DTZ table for a particular position.
-// If *result != FAIL, the probe was successful.
-// The return value is from the point of view of the side to move:
-//         n < -100 : loss, but draw under 50-move rule
-// -100 <= n < -1   : loss in n ply (assuming 50-move counter == 0)
-//         0        : draw
-//     1 < n <= 100 : win in n ply (assuming 50-move counter == 0)
-//   100 < n        : win, but draw under 50-move rule
-//
-// The return value n can be off by 1: a return value -n can mean a loss
-// in n+1 ply and a return value +n can mean a win in n+1 ply. This
-// cannot happen for tables with positions exactly on the "edge" of
-// the 50-move rule.
-//
-// This implies that if dtz > 0 is returned, the position is certainly
-// a win if dtz + 50-move-counter <= 99. Care must be taken that the engine
-// picks moves that preserve dtz + 50-move-counter <= 99.
-//
-// If n = 100 immediately after a capture or pawn move, then the position
-// is also certainly a win, and during the whole phase until the next
-// capture or pawn move, the inequality to be preserved is
-// dtz + 50-movecounter <= 100.
-//
-// In short, if a move is available resulting in dtz + 50-move-counter <= 99,
-// then do not accept moves leading to dtz + 50-move-counter == 100.
-int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
+static int cached_probe_dtz(Position& pos, ProbeState* result);
+
+// do_probe_dtz() does the actual DTZ probe of probe_dtz()
+static int do_probe_dtz(Position& pos, ProbeState* result) {
 
     *result = OK;
     WDLScore wdl = search<true>(pos, result);
@@ -1464,7 +1969,7 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
         // position after the move to get the score sign (because even in a
         // winning position we could make a losing capture or going for a draw).
         dtz = zeroing ? -dtz_before_zeroing(search(pos, result))
-                      : -probe_dtz(pos, result);
+                      : -cached_probe_dtz(pos, result);
 
         pos.undo_move(move);
 
@@ -1481,12 +1986,71 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
             minDTZ = dtz;
     }
 
+    // The probes of the 1-ply search left *result with the state of the last
+    // child, or CHANGE_STM when there is no legal move. Report success instead,
+    // so that a cached result is the same as a fresh one.
+    *result = OK;
+
     // Special handle a mate position, when there are no legal moves, in this
     // case return value is somewhat arbitrary, so stick to the original TB code
     // that returns -1 in this case.
     return minDTZ == 0xFFFF ? -1 : minDTZ;
 }
 
+// Probe the DTZ table for a particular position.
+// If *result != FAIL, the probe was successful.
+// The return value is from the point of view of the side to move:
+//         n < -100 : loss, but draw under 50-move rule
+// -100 <= n < -1   : loss in n ply (assuming 50-move counter == 0)
+//         0        : draw
+//     1 < n <= 100 : win in n ply (assuming 50-move counter == 0)
+//   100 < n        : win, but draw under 50-move rule
+//
+// The return value n can be off by 1: a return value -n can mean a loss
+// in n+1 ply and a return value +n can mean a win in n+1 ply. This
+// cannot happen for tables with positions exactly on the "edge" of
+// the 50-move rule.
+//
+// This implies that if dtz > 0 is returned, the position is certainly
+// a win if dtz + 50-move-counter <= 99. Care must be taken that the engine
+// picks moves that preserve dtz + 50-move-counter <= 99.
+//
+// If n = 100 immediately after a capture or pawn move, then the position
+// is also certainly a win, and during the whole phase until the next
+// capture or pawn move, the inequality to be preserved is
+// dtz + 50-movecounter <= 100.
+//
+// In short, if a move is available resulting in dtz + 50-move-counter <= 99,
+// then do not accept moves leading to dtz + 50-move-counter == 100.
+//
+// As for probe_wdl(), results are cached, in DTZCache.
+int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
+
+    StageTimer timer(pos, PROBE_DTZ);
+    return cached_probe_dtz(pos, result);
+}
+
+// cached_probe_dtz() looks up the DTZ cache before probing
+static int cached_probe_dtz(Position& pos, ProbeState* result) {
+
+    int dtz;
+
+    if (DTZCache.probe(pos.key(), &dtz, result))
+    {
+        if (pos.this_thread())
+            pos.this_thread()->tbCacheHits.fetch_add(1, std::memory_order_relaxed);
+
+        return dtz;
+    }
+
+    dtz = do_probe_dtz(pos, result);
+
+    if (*result != FAIL)
+        DTZCache.store(pos.key(), dtz, *result);
+
+    return dtz;
+}
+
 // Check whether there has been at least one repetition of positions
 // since the last capture or pawn move.
 static int has_repeated(StateInfo *st)
@@ -1522,6 +2086,7 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, Value&
 {
     assert(rootMoves.size());
 
+    StageTimer timer(pos, ROOT_PROBE);
     ProbeState result;
     int dtz = probe_dtz(pos, &result);
 
@@ -1653,6 +2218,7 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, Value&
 // no moves were filtered out.
 bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, Value& score)
 {
+    StageTimer timer(pos, ROOT_PROBE);
     ProbeState result;
 
     WDLScore wdl = Tablebases::probe_wdl(pos, &result);
@@ -1693,3 +2259,134 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, Val
 
     return true;
 }
+
+// Tablebases::line() fills 'pv' with a DTZ-optimal line from the given position,
+// without any search: the winning side plays the move that mates or zeroes the
+// 50-move counter soonest, the losing side the one that delays it most. The line
+// ends at mate or when the position is a draw. Returns false if a table is
+// missing, with 'pv' holding the moves found so far. The position is restored.
+
+bool Tablebases::line(Position& pos, std::vector<Move>& pv, WDLScore* wdl, int* dtz) {
+
+    const size_t MaxLine = 4096; // Lines are finite, unless a table is corrupted
+    const int Mate = 0x10000;
+
+    // Rank the values of the moves: a mate first, then the wins from the
+    // fastest, then the draws and then the losses from the slowest.
+    auto rank = [](int v) { return v == Mate ? 2 * Mate : v > 0 ? Mate - v : v < 0 ? -Mate - v : 0; };
+
+    std::deque<StateInfo> states;
+    ProbeState result;
+    bool ok = false;
+
+    pv.clear();
+    *wdl = probe_wdl(pos, &result);
+    *dtz = result != FAIL ? probe_dtz(pos, &result) : 0;
+
+    while (result != FAIL && pv.size() < MaxLine)
+    {
+        if (probe_wdl(pos, &result) == WDLDraw || result == FAIL)
+        {
+            ok = result != FAIL;
+            break;
+        }
+
+        Move best = MOVE_NONE;
+        int bestValue = 0;
+
+        // Score each move like root_probe() does, but stop at a mate
+        for (Move move : MoveList<LEGAL>(pos))
+        {
+            StateInfo st;
+            pos.do_move(move, st);
+            int v;
+
+            if (pos.checkers() && !MoveList<LEGAL>(pos).size())
+                v = Mate;
+
+            else if (st.rule50 != 0)
+            {
+                v = -probe_dtz(pos, &result);
+                v += sign_of(v);
+            }
+            else
+                v = dtz_before_zeroing(-probe_wdl(pos, &result));
+
+            pos.undo_move(move);
+
+            if (result == FAIL)
+                break;
+
+            if (!best || rank(v) > rank(bestValue))
+                best = move, bestValue = v;
+
+            if (v == Mate)
+                break;
+        }
+
+        if (result == FAIL)
+            break;
+
+        if (!best) // Mated
+        {
+            ok = true;
+            break;
+        }
+
+        pv.push_back(best);
+        states.emplace_back();
+        pos.do_move(best, states.back());
+    }
+
+    for (auto it = pv.rbegin(); it != pv.rend(); ++it)
+        pos.undo_move(*it);
+
+    return ok;
+}
+
+/// Tablebases::line_batch() writes to 'lines' the result of line() for each of
+/// the given positions, as the WDL score, the DTZ and the moves of the line,
+/// separated by commas, or "none" if the position has more than 'limit' pieces,
+/// castling rights or a missing table. The work is split among as many workers
+/// as there are search threads, so no search must be running.
+
+void Tablebases::line_batch(const std::vector<std::string>& fens, std::string* lines,
+                            bool chess960, int limit) {
+
+    std::vector<std::thread> workers;
+    size_t workerCnt = Threads.size();
+
+    for (size_t idx = 0; idx < workerCnt; ++idx)
+        workers.emplace_back([&, idx]() {
+
+            Position pos;
+            StateInfo st;
+            std::vector<Move> pv;
+            WDLScore wdl;
+            int dtz;
+
+            for (size_t i = idx; i < fens.size(); i += workerCnt)
+            {
+                pos.set(fens[i], chess960, &st, Threads[idx]);
+
+                if (   popcount(pos.pieces()) > limit
+                    || pos.can_castle(ANY_CASTLING)
+                    || !line(pos, pv, &wdl, &dtz))
+                {
+                    lines[i] = "none";
+                    continue;
+                }
+
+                std::stringstream ss;
+                ss << wdl << "," << dtz << ",";
+
+                for (size_t j = 0; j < pv.size(); ++j)
+                    ss << (j ? " " : "") << UCI::move(pv[j], chess960);
+
+                lines[i] = ss.str();
+            }
+        });
+
+    for (std::thread& w : workers)
+        w.join();
+}
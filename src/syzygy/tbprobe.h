@@ -21,6 +21,8 @@
 #define TBPROBE_H
 
 #include <ostream>
+#include <string>
+#include <vector>
 
 #include "../search.h"
 
@@ -44,14 +46,49 @@ enum ProbeState {
     ZEROING_BEST_MOVE =  2  // Best move zeroes DTZ (capture or pawn move)
 };
 
+/// ProbeStats counts, for each thread, the calls to the probing functions and
+/// the time spent in them, in CPU ticks. PROBE_WDL, PROBE_DTZ and ROOT_PROBE are
+/// the totals of probe_wdl(), probe_dtz() and of the root probes. The other stages
+/// are parts of them: the mapping of a file at its first probe, the computation
+/// of the index in the table and the decompression of the value. wdlLatency[i]
+/// counts the probe_wdl() calls that took from 2^i to 2^(i+1) - 1 ticks.
+
+enum ProbeStage {
+    PROBE_WDL, PROBE_DTZ, ROOT_PROBE, PROBE_MAP, PROBE_INDEX, PROBE_DECOMPRESS, PROBE_STAGE_NB
+};
+
+struct ProbeStats {
+
+    ProbeStats& operator+=(const ProbeStats& s) {
+        for (int i = 0; i < PROBE_STAGE_NB; ++i)
+            calls[i] += s.calls[i], ticks[i] += s.ticks[i];
+        for (int i = 0; i < LATENCY_BUCKET_NB; ++i)
+            wdlLatency[i] += s.wdlLatency[i];
+        return *this;
+    }
+
+    static const int LATENCY_BUCKET_NB = 40;
+
+    uint64_t calls[PROBE_STAGE_NB];
+    uint64_t ticks[PROBE_STAGE_NB];
+    uint64_t wdlLatency[LATENCY_BUCKET_NB];
+};
+
 extern int MaxCardinality;
 
-void init(const std::string& paths);
+void init(const std::string& paths, bool premapTables = false);
+void stop_mapping();
+void set_advice(const std::string& policy);
+std::string warm(const std::vector<std::string>& codes);
+std::string stats();
+std::string bench(int count);
 WDLScore probe_wdl(Position& pos, ProbeState* result);
 int probe_dtz(Position& pos, ProbeState* result);
 bool root_probe(Position& pos, Search::RootMoves& rootMoves, Value& score);
 bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, Value& score);
 void filter_root_moves(Position& pos, Search::RootMoves& rootMoves);
+bool line(Position& pos, std::vector<Move>& pv, WDLScore* wdl, int* dtz);
+void line_batch(const std::vector<std::string>& fens, std::string* lines, bool chess960, int limit);
 
 inline std::ostream& operator<<(std::ostream& os, const WDLScore v) {
 
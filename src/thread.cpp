@@ -36,7 +36,11 @@ Thread::Thread() {
 
   exit = false;
   selDepth = 0;
-  nodes = tbHits = 0;
+  nodes = tbHits = tbCacheHits = 0;
+  evalProbes = evalHits = 0;
+  evalProfile = Eval::Profile();
+  tbStats = Tablebases::ProbeStats();
+  pawnsTable.resize(Options["Pawn Hash"]);
   idx = Threads.size(); // Start from 0
 
   std::unique_lock<Mutex> lk(mutex);
@@ -119,7 +123,7 @@ void Thread::idle_loop() {
 /// ThreadPool::init() creates and launches requested threads that will go
 /// immediately to sleep. We cannot use a constructor because Threads is a
 /// static object and we need a fully initialized engine at this point due to
-/// allocation of Endgames in the Thread constructor.
+/// the UCI options read in the Thread constructor.
 
 void ThreadPool::init() {
 
@@ -179,6 +183,18 @@ uint64_t ThreadPool::tb_hits() const {
 }
 
 
+/// ThreadPool::tb_cache_hits() returns the number of TB probes answered by the
+/// probe result cache.
+
+uint64_t ThreadPool::tb_cache_hits() const {
+
+  uint64_t hits = 0;
+  for (Thread* th : *this)
+      hits += th->tbCacheHits.load(std::memory_order_relaxed);
+  return hits;
+}
+
+
 /// ThreadPool::start_thinking() wakes up the main thread sleeping in idle_loop()
 /// and starts a new search, then returns immediately.
 
@@ -206,18 +222,22 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   if (states.get())
       setupStates = std::move(states); // Ownership transfer, states is now empty
 
-  StateInfo tmp = setupStates->back();
-
   for (Thread* th : Threads)
   {
       th->nodes = 0;
-      th->tbHits = 0;
+      th->tbHits = th->tbCacheHits = 0;
+      th->evalProbes = th->evalHits = 0;
+      th->evalProfile = Eval::Profile();
+      th->pawnsTable.probes = th->pawnsTable.hits = 0;
+      th->pawnsTable.kingSafetyCalls = th->pawnsTable.kingSafetyUpdates = 0;
       th->rootDepth = DEPTH_ZERO;
       th->rootMoves = rootMoves;
-      th->rootPos.set(pos.fen(), pos.is_chess960(), &setupStates->back(), th);
-  }
+      th->rootPos.set(pos.fen(), pos.is_chess960(), &th->rootState, th);
+      th->rootState = setupStates->back(); // Restore st->previous, cleared by Position::set()
 
-  setupStates->back() = tmp; // Restore st->previous, cleared by Position::set()
+      if (NNUE::Enabled)
+          NNUE::refresh_accumulator(th->rootPos);
+  }
 
   main()->start_searching();
 }
@@ -27,12 +27,14 @@
 #include <thread>
 #include <vector>
 
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
 #include "thread_win32.h"
+#include "syzygy/tbprobe.h"
 
 
 /// Thread struct keeps together all the thread-related stuff. We also use
@@ -58,12 +60,16 @@ public:
 
   Pawns::Table pawnsTable;
   Material::Table materialTable;
-  Endgames endgames;
+  Eval::Table evalTable;
   size_t idx, PVIdx;
   int selDepth;
-  std::atomic<uint64_t> nodes, tbHits;
+  std::atomic<uint64_t> nodes, tbHits, tbCacheHits;
+  uint64_t evalProbes, evalHits;
+  Eval::Profile evalProfile;
+  Tablebases::ProbeStats tbStats;
 
   Position rootPos;
+  StateInfo rootState; // Own copy, the search fills in its lazy fields
   Search::RootMoves rootMoves;
   Depth rootDepth;
   Depth completedDepth;
@@ -100,6 +106,7 @@ struct ThreadPool : public std::vector<Thread*> {
   void read_uci_options();
   uint64_t nodes_searched() const;
   uint64_t tb_hits() const;
+  uint64_t tb_cache_hits() const;
 
   std::atomic_bool stop, stopOnPonderhit;
 
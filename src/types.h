@@ -37,6 +37,19 @@
 ///
 /// -DUSE_PEXT    | Add runtime support for use of pext asm-instruction. Works
 ///               | only in 64-bit mode and requires hardware with pext support.
+///
+/// -DUSE_DISPATCH | Detect popcnt, pext and avx2 support at startup instead of
+///                | at compile time. Works only in 64-bit mode with gcc or a
+///                | compatible compiler. Do not combine with the two above.
+///
+/// -DUSE_ATTACK_MAPS | Keep the attacks of every piece in Position, updated
+///                   | incrementally in do_move() and used by the evaluation.
+///
+/// -DUSE_EVAL_CACHE  | Keep a per-thread cache of the evaluations, keyed by
+///                   | the position key.
+///
+/// -DUSE_EVAL_PROFILE | Time each stage of the evaluation and report the
+///                    | breakdown at the end of a bench run.
 
 #include <cassert>
 #include <cctype>
@@ -72,13 +85,35 @@
 #  include <xmmintrin.h> // Intel and Microsoft header for _mm_prefetch()
 #endif
 
+#if defined(USE_DISPATCH) && (!defined(IS_64BIT) || !defined(__GNUC__))
+#  error "USE_DISPATCH requires a 64-bit build with gcc or a compatible compiler"
+#endif
+
+#if defined(USE_DISPATCH) && (defined(USE_POPCNT) || defined(USE_PEXT))
+#  error "USE_DISPATCH cannot be combined with USE_POPCNT or USE_PEXT"
+#endif
+
 #if defined(USE_PEXT)
 #  include <immintrin.h> // Header for _pext_u64() intrinsic
 #  define pext(b, m) _pext_u64(b, m)
+#elif defined(USE_DISPATCH)
+// The instruction is emitted directly, so that the binary can be compiled
+// without -mbmi2. It is executed only when CPU::init() has set HasPext.
+inline uint64_t pext(uint64_t b, uint64_t m) {
+  uint64_t r;
+  __asm__("pext %2, %1, %0" : "=r" (r) : "r" (b), "r" (m));
+  return r;
+}
 #else
 #  define pext(b, m) 0
 #endif
 
+#if defined(USE_DISPATCH)
+extern bool HasPopCnt; // Set at startup by CPU::init()
+extern bool HasPext;
+extern bool HasAvx2;
+#else
+
 #ifdef USE_POPCNT
 const bool HasPopCnt = true;
 #else
@@ -91,6 +126,32 @@ const bool HasPext = true;
 const bool HasPext = false;
 #endif
 
+#ifdef __AVX2__
+const bool HasAvx2 = true;
+#else
+const bool HasAvx2 = false;
+#endif
+
+#endif // #if defined(USE_DISPATCH)
+
+#ifdef USE_ATTACK_MAPS
+const bool HasAttackMaps = true;
+#else
+const bool HasAttackMaps = false;
+#endif
+
+#ifdef USE_EVAL_CACHE
+const bool HasEvalCache = true;
+#else
+const bool HasEvalCache = false;
+#endif
+
+#ifdef USE_EVAL_PROFILE
+const bool HasEvalProfile = true;
+#else
+const bool HasEvalProfile = false;
+#endif
+
 #ifdef IS_64BIT
 const bool Is64Bit = true;
 #else
@@ -19,7 +19,9 @@
 */
 
 #include <cassert>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 #include <string>
 
@@ -45,7 +47,7 @@ namespace {
   // A list to keep track of the position states along the setup moves (from the
   // start position to the position just before the search starts). Needed by
   // 'draw by repetition' detection.
-  StateListPtr States(new std::deque<StateInfo>(1));
+  StateListPtr States(new std::vector<StateInfo>(1));
 
 
   // position() is called when engine receives the "position" UCI command.
@@ -71,13 +73,28 @@ namespace {
     else
         return;
 
-    States = StateListPtr(new std::deque<StateInfo>(1));
+    // Reserve the whole history at once, so that parsing the move list does
+    // not allocate and the StateInfo objects are never moved.
+    size_t moves = 0;
+
+    if (is)
+    {
+        std::streampos start = is.tellg();
+        moves = std::distance(std::istream_iterator<string>(is), std::istream_iterator<string>());
+        is.clear();
+        is.seekg(start);
+    }
+
+    States = StateListPtr(new std::vector<StateInfo>(1));
+    States->reserve(moves + 1);
     pos.set(fen, Options["UCI_Chess960"], &States->back(), Threads.main());
 
     // Parse move list (if any)
     while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
     {
-        States->push_back(StateInfo());
+        assert(States->size() < States->capacity());
+
+        States->emplace_back();
         pos.do_move(m, States->back());
     }
   }
@@ -138,12 +155,156 @@ namespace {
     Threads.start_thinking(pos, States, limits);
   }
 
+  // evalbatch() is called when engine receives the "evalbatch" command. It reads
+  // the FENs of the given file, one per line, evaluates them with all threads
+  // and writes a line with the FEN and its static evaluation, separated by a
+  // comma, to the output file or to stdout. The evaluation is in internal units
+  // from the point of view of the side to move, "none" when it is in check.
+
+  void evalbatch(istringstream& is) {
+
+    const size_t ChunkSize = 1 << 16;
+
+    string inFile, outFile, fen;
+    vector<string> fens;
+    vector<Value> values(ChunkSize);
+    uint64_t cnt = 0;
+
+    is >> inFile >> outFile;
+
+    ifstream in(inFile);
+    ofstream out;
+
+    if (!in.is_open())
+    {
+        sync_cout << "Unable to open file " << inFile << sync_endl;
+        return;
+    }
+
+    if (!outFile.empty())
+        out.open(outFile);
+
+    ostream& os = outFile.empty() ? cout : out;
+    TimePoint elapsed = now();
+
+    Threads.main()->wait_for_search_finished();
+
+    while (in)
+    {
+        fens.clear();
+
+        while (fens.size() < ChunkSize && getline(in, fen))
+            if (!fen.empty())
+                fens.push_back(fen);
+
+        Eval::evaluate_batch(fens, &values[0], Options["UCI_Chess960"]);
+
+        string buf;
+        for (size_t i = 0; i < fens.size(); ++i)
+            buf += fens[i] + (values[i] == VALUE_NONE ? ",none\n" : "," + to_string(values[i]) + "\n");
+
+        os << buf;
+        cnt += fens.size();
+    }
+
+    elapsed = now() - elapsed + 1;
+
+    cerr << "\nPositions evaluated : " << cnt
+         << "\nTotal time (ms)     : " << elapsed
+         << "\nPositions/second    : " << 1000 * cnt / elapsed << endl;
+  }
+
+
+  // tbwarm() is called when engine receives the "tbwarm" command, followed by
+  // the tables to read into the page cache, like "KRvK KQvKR", or by nothing
+  // to read all of them.
+
+  void tbwarm(istringstream& is) {
+
+    string token;
+    vector<string> codes;
+
+    while (is >> token)
+        codes.push_back(token);
+
+    sync_cout << Tablebases::warm(codes) << sync_endl;
+  }
+
+
+  // tbline() is called when engine receives the "tbline" command. Without
+  // arguments it prints the DTZ-optimal line from the current position. Else
+  // it reads the FENs of the given file, one per line, and writes a line with
+  // the FEN, the WDL score, the DTZ and the moves of the line, separated by
+  // commas, to the output file or to stdout. All threads are used.
+
+  void tbline(Position& pos, istringstream& is) {
+
+    const size_t ChunkSize = 1 << 12;
+
+    string inFile, outFile, fen;
+    vector<string> fens, lines(ChunkSize);
+    int limit = Options["SyzygyProbeLimit"];
+    bool chess960 = Options["UCI_Chess960"];
+    uint64_t cnt = 0;
+
+    Threads.main()->wait_for_search_finished();
+
+    if (!(is >> inFile))
+    {
+        Tablebases::line_batch({ pos.fen() }, &lines[0], chess960, limit);
+        sync_cout << "info string " << lines[0] << sync_endl;
+        return;
+    }
+
+    is >> outFile;
+
+    ifstream in(inFile);
+    ofstream out;
+
+    if (!in.is_open())
+    {
+        sync_cout << "Unable to open file " << inFile << sync_endl;
+        return;
+    }
+
+    if (!outFile.empty())
+        out.open(outFile);
+
+    ostream& os = outFile.empty() ? cout : out;
+    TimePoint elapsed = now();
+
+    while (in)
+    {
+        fens.clear();
+
+        while (fens.size() < ChunkSize && getline(in, fen))
+            if (!fen.empty())
+                fens.push_back(fen);
+
+        Tablebases::line_batch(fens, &lines[0], chess960, limit);
+
+        string buf;
+        for (size_t i = 0; i < fens.size(); ++i)
+            buf += fens[i] + "," + lines[i] + "\n";
+
+        os << buf;
+        cnt += fens.size();
+    }
+
+    elapsed = now() - elapsed + 1;
+
+    cerr << "\nPositions analysed  : " << cnt
+         << "\nTotal time (ms)     : " << elapsed
+         << "\nPositions/second    : " << 1000 * cnt / elapsed << endl;
+  }
+
+
   // On ucinewgame following steps are needed to reset the state
   void newgame() {
 
     TT.resize(Options["Hash"]);
     Search::clear();
-    Tablebases::init(Options["SyzygyPath"]);
+    Tablebases::init(Options["SyzygyPath"], Options["SyzygyPremap"]);
     Time.availableNodes = 0;
   }
 
@@ -198,7 +359,11 @@ void UCI::loop(int argc, char* argv[]) {
                     << "\nuciok"  << sync_endl;
 
       else if (token == "ucinewgame") newgame();
-      else if (token == "isready")    sync_cout << "readyok" << sync_endl;
+      else if (token == "isready")
+      {
+          Bitbases::wait();
+          sync_cout << "readyok" << sync_endl;
+      }
       else if (token == "go")         go(pos, is);
       else if (token == "position")   position(pos, is);
       else if (token == "setoption")  setoption(is);
@@ -208,6 +373,17 @@ void UCI::loop(int argc, char* argv[]) {
       else if (token == "bench")      benchmark(pos, is);
       else if (token == "d")          sync_cout << pos << sync_endl;
       else if (token == "eval")       sync_cout << Eval::trace(pos) << sync_endl;
+      else if (token == "evalbatch")  evalbatch(is);
+      else if (token == "tbwarm")     tbwarm(is);
+      else if (token == "tbstats")    sync_cout << Tablebases::stats() << sync_endl;
+      else if (token == "tbline")     tbline(pos, is);
+      else if (token == "tbbench")
+      {
+          int count = 10000;
+
+          is >> count;
+          sync_cout << Tablebases::bench(count) << sync_endl;
+      }
       else if (token == "perft")
       {
           int depth;
@@ -21,8 +21,10 @@
 #include <algorithm>
 #include <cassert>
 #include <ostream>
+#include <sstream>
 
 #include "misc.h"
+#include "nnue.h"
 #include "search.h"
 #include "thread.h"
 #include "tt.h"
@@ -40,7 +42,10 @@ void on_clear_hash(const Option&) { Search::clear(); }
 void on_hash_size(const Option& o) { TT.resize(o); }
 void on_logger(const Option& o) { start_logger(o); }
 void on_threads(const Option&) { Threads.read_uci_options(); }
-void on_tb_path(const Option& o) { Tablebases::init(o); }
+void on_pawn_hash(const Option& o) { for (Thread* th : Threads) th->pawnsTable.resize(o); }
+void on_tb_advice(const Option& o) { Tablebases::set_advice(o); }
+void on_tb_path(const Option&) { Tablebases::init(Options["SyzygyPath"], Options["SyzygyPremap"]); }
+void on_eval_file(const Option&) { NNUE::init(); }
 
 
 /// Our case insensitive less() function as required by UCI protocol
@@ -61,6 +66,7 @@ void init(OptionsMap& o) {
   o["Contempt"]              << Option(0, -100, 100);
   o["Threads"]               << Option(1, 1, 512, on_threads);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
+  o["Pawn Hash"]             << Option(2, 1, 1024, on_pawn_hash);
   o["Clear Hash"]            << Option(on_clear_hash);
   o["Ponder"]                << Option(false);
   o["MultiPV"]               << Option(1, 1, 500);
@@ -73,7 +79,11 @@ void init(OptionsMap& o) {
   o["SyzygyPath"]            << Option("<empty>", on_tb_path);
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["Syzygy50MoveRule"]      << Option(true);
-  o["SyzygyProbeLimit"]      << Option(6, 0, 6);
+  o["SyzygyProbeLimit"]      << Option(7, 0, 7);
+  o["SyzygyPremap"]          << Option(false, on_tb_path);
+  o["SyzygyMadvise"]         << Option("Normal var Normal var Random var Willneed", "Normal", on_tb_advice);
+  o["Use NNUE"]              << Option(false, on_eval_file);
+  o["EvalFile"]              << Option("<empty>", on_eval_file);
 }
 
 
@@ -116,13 +126,16 @@ Option::Option(OnChange f) : type("button"), min(0), max(0), on_change(f)
 Option::Option(int v, int minv, int maxv, OnChange f) : type("spin"), min(minv), max(maxv), on_change(f)
 { defaultValue = currentValue = std::to_string(v); }
 
+Option::Option(const char* v, const char* cur, OnChange f) : type("combo"), min(0), max(0), on_change(f)
+{ defaultValue = v; currentValue = cur; }
+
 Option::operator int() const {
   assert(type == "check" || type == "spin");
   return (type == "spin" ? stoi(currentValue) : currentValue == "true");
 }
 
 Option::operator std::string() const {
-  assert(type == "string");
+  assert(type == "string" || type == "combo");
   return currentValue;
 }
 
@@ -151,6 +164,20 @@ Option& Option::operator=(const string& v) {
       || (type == "spin" && (stoi(v) < min || stoi(v) > max)))
       return *this;
 
+  // A combo default value is like "Normal var Normal var Random", so check the
+  // new value against the 'var' tokens, case insensitively.
+  if (type == "combo")
+  {
+      OptionsMap comboMap;
+      string token;
+      std::istringstream ss(defaultValue);
+      while (ss >> token)
+          comboMap[token] << Option();
+
+      if (!comboMap.count(v) || v == "var")
+          return *this;
+  }
+
   if (type != "button")
       currentValue = v;
 
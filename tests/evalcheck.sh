@@ -0,0 +1,28 @@
+#!/bin/bash
+# verify the incrementally updated evaluation terms against a full computation,
+# on the positions of an optional FEN file (defaults to the bench positions) and
+# on random games played from each of them. Needs a debug build.
+
+error()
+{
+  echo "eval equivalence testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+echo "eval equivalence testing started"
+
+fens=${1:-default}
+games=${2:-100}
+
+./stockfish bench 16 1 $games $fens evalcheck > evalcheck.out 2>&1
+
+# report the mismatches, if any
+grep "Mismatch:\|needs a debug build" evalcheck.out || true
+
+grep "Terms checked   : [1-9]" evalcheck.out > /dev/null
+grep "Mismatches      : 0$" evalcheck.out > /dev/null
+
+rm evalcheck.out
+
+echo "eval equivalence testing OK"